@@ -0,0 +1,112 @@
+#pragma once
+
+// Shared helpers for the programs in this directory. Each one is built by its own Makefile target
+// and linked straight against the library objects, so internal functions can be called too.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "libsm64.h"
+
+static double bench_now_ms( void )
+{
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Small deterministic generator so every run sees the same inputs
+static uint32_t s_bench_seed = 12345;
+
+static uint32_t bench_rand( void )
+{
+    s_bench_seed = s_bench_seed * 1664525u + 1013904223u;
+    return s_bench_seed >> 8;
+}
+
+static float bench_randf( float lo, float hi )
+{
+    return lo + ( hi - lo ) * (float)( bench_rand() & 0xFFFF ) / 65535.0f;
+}
+
+static uint8_t *bench_read_rom( const char *path, size_t *outSize )
+{
+    FILE *f = fopen( path, "rb" );
+    if( !f )
+    {
+        fprintf( stderr, "Can't open ROM %s, pass it with ROM=<path>\n", path );
+        return NULL;
+    }
+
+    fseek( f, 0, SEEK_END );
+    size_t size = (size_t)ftell( f );
+    fseek( f, 0, SEEK_SET );
+
+    uint8_t *rom = malloc( size );
+    if( fread( rom, 1, size, f ) != size )
+    {
+        fclose( f );
+        free( rom );
+        return NULL;
+    }
+
+    fclose( f );
+    *outSize = size;
+    return rom;
+}
+
+static void bench_add_quad( struct SM64Surface *out, int16_t x0, int16_t z0, int16_t x1, int16_t z1, int16_t y )
+{
+    const int32_t corners[4][3] = { { x0, y, z0 }, { x1, y, z0 }, { x1, y, z1 }, { x0, y, z1 } };
+    const int order[2][3] = { { 0, 2, 1 }, { 0, 3, 2 } };
+
+    for( int t = 0; t < 2; ++t )
+    {
+        memset( &out[t], 0, sizeof( struct SM64Surface ));
+        for( int v = 0; v < 3; ++v )
+            memcpy( out[t].vertices[v], corners[order[t][v]], sizeof( corners[0] ));
+    }
+}
+
+// A flat floor with a raised step, enough for walking, jumping and ledge grabs
+static void bench_load_level( void )
+{
+    struct SM64Surface surfaces[4];
+    bench_add_quad( &surfaces[0], -4000, -4000, 4000, 4000, 0 );
+    bench_add_quad( &surfaces[2], 500, -4000, 4000, 4000, 200 );
+    sm64_static_surfaces_load( surfaces, 4 );
+}
+
+// Scripted input that keeps changing direction and mixes jumps, punches and crouches
+static void bench_inputs_for( uint32_t tick, struct SM64MarioInputs *inputs )
+{
+    memset( inputs, 0, sizeof( struct SM64MarioInputs ));
+    inputs->camLookX = 1.0f;
+    inputs->camLookZ = 0.3f;
+    inputs->stickX = ( tick / 40 ) % 2 ? 0.8f : -0.3f;
+    inputs->stickY = ( tick / 25 ) % 3 == 0 ? 1.0f : 0.2f;
+    inputs->buttonA = tick % 50 < 3 || ( tick % 50 >= 10 && tick % 50 < 12 );
+    inputs->buttonB = tick % 90 == 60;
+    inputs->buttonZ = tick % 120 > 110;
+}
+
+static void bench_alloc_geometry( struct SM64MarioGeometryBuffers *geometry )
+{
+    memset( geometry, 0, sizeof( struct SM64MarioGeometryBuffers ));
+    geometry->position = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+    geometry->normal   = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+    geometry->color    = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+    geometry->uv       = malloc( sizeof( float ) * 6 * SM64_GEO_MAX_TRIANGLES );
+}
+
+static void bench_free_geometry( struct SM64MarioGeometryBuffers *geometry )
+{
+    free( geometry->position );
+    free( geometry->normal );
+    free( geometry->color );
+    free( geometry->uv );
+}
\ No newline at end of file
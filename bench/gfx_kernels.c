@@ -0,0 +1,106 @@
+// Runs every SIMD transform kernel the CPU supports against the scalar reference on the same random
+// inputs, including counts that leave a partial group for the scalar tail, and times each level.
+
+#include <math.h>
+#include <string.h>
+
+#include "bench.h"
+#include "gfx_kernels.h"
+
+#define MAX_COUNT 4099
+#define TOLERANCE 1e-4f
+
+static const char *s_level_names[] = { "scalar", "sse2", "avx" };
+
+static void random_matrix( Mat4 mtx )
+{
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 4; ++j )
+            mtx[i][j] = bench_randf( -2.0f, 2.0f );
+}
+
+// Largest difference relative to the magnitude of the reference value, with an absolute floor of 1
+static float compare( const float *ref, const float *out, uint32_t count )
+{
+    float worst = 0.0f;
+    for( uint32_t i = 0; i < 3 * count; ++i )
+    {
+        float scale = fabsf( ref[i] ) > 1.0f ? fabsf( ref[i] ) : 1.0f;
+        float err = fabsf( ref[i] - out[i] ) / scale;
+        if( err > worst || err != err )
+            worst = err;
+    }
+    return worst;
+}
+
+int main( void )
+{
+    float *in = malloc( 3 * MAX_COUNT * sizeof( float ));
+    float *ref = malloc( 3 * MAX_COUNT * sizeof( float ));
+    float *out = malloc( 3 * MAX_COUNT * sizeof( float ));
+    bool failed = false;
+
+    for( uint32_t i = 0; i < 3 * MAX_COUNT; ++i )
+        in[i] = bench_randf( -1000.0f, 1000.0f );
+
+    static const struct { const char *name; GfxTransformKernel *kernel; GfxTransformKernel scalar; } kernels[] = {
+        { "positions", &gfx_transform_positions, gfx_transform_positions_scalar },
+        { "vectors",   &gfx_transform_vectors,   gfx_transform_vectors_scalar },
+        { "normals",   &gfx_transform_normals,   gfx_transform_normals_scalar },
+    };
+
+    for( int level = GFX_KERNEL_SCALAR; level <= GFX_KERNEL_AVX; ++level )
+    {
+        if( gfx_kernels_select( (enum GfxKernelLevel)level ) != level )
+        {
+            printf( "%-6s not supported, skipped\n", s_level_names[level] );
+            continue;
+        }
+
+        for( int k = 0; k < 3; ++k )
+        {
+            float worst = 0.0f;
+
+            for( uint32_t count = 0; count <= 37; ++count )
+            {
+                Mat4 mtx;
+                random_matrix( mtx );
+                kernels[k].scalar( mtx, in, ref, count );
+                (*kernels[k].kernel)( mtx, in, out, count );
+
+                float err = compare( ref, out, count );
+                if( err > worst || err != err )
+                    worst = err;
+            }
+
+            Mat4 mtx;
+            random_matrix( mtx );
+            kernels[k].scalar( mtx, in, ref, MAX_COUNT );
+            memset( out, 0, 3 * MAX_COUNT * sizeof( float ));
+
+            double best = 1e9;
+            for( int rep = 0; rep < 50; ++rep )
+            {
+                double start = bench_now_ms();
+                (*kernels[k].kernel)( mtx, in, out, MAX_COUNT );
+                double ms = bench_now_ms() - start;
+                if( ms < best )
+                    best = ms;
+            }
+
+            float err = compare( ref, out, MAX_COUNT );
+            if( err > worst || err != err )
+                worst = err;
+
+            bool ok = worst <= TOLERANCE;
+            failed |= !ok;
+            printf( "%-6s %-9s max error %.2e %s, %.1f Mvertices/s\n", s_level_names[level], kernels[k].name,
+                worst, ok ? "ok" : "FAILED", MAX_COUNT / best / 1e3 );
+        }
+    }
+
+    free( in );
+    free( ref );
+    free( out );
+    return failed ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+// Finds every MIO0 block in the ROM and decodes it with both mio0_decode and mio0_decode_fast,
+// which have to agree on the output and on how much input they consumed, then compares their speed.
+
+#include "bench.h"
+#include "decomp/tools/libmio0.h"
+
+#define NUM_REPS 10
+
+// Best time of NUM_REPS decodes, or a negative value if the decoder failed
+static double time_decode( int (*decode)( const unsigned char *, unsigned char *, unsigned int * ), const uint8_t *in, uint8_t *out, unsigned int *end, int *result )
+{
+    double best = 1e9;
+    for( int rep = 0; rep < NUM_REPS; ++rep )
+    {
+        double start = bench_now_ms();
+        *result = decode( in, out, end );
+        double ms = bench_now_ms() - start;
+        if( ms < best )
+            best = ms;
+    }
+    return best;
+}
+
+int main( int argc, char **argv )
+{
+    const char *romPath = argc > 1 ? argv[1] : "sm64.us.z64";
+    size_t romSize;
+
+    uint8_t *rom = bench_read_rom( romPath, &romSize );
+    if( !rom )
+        return 1;
+
+    uint32_t numBlocks = 0, numBad = 0;
+    size_t totalBytes = 0;
+    double totalRef = 0.0, totalFast = 0.0;
+
+    for( size_t offset = 0; offset + MIO0_HEADER_LENGTH <= romSize; ++offset )
+    {
+        mio0_header_t head;
+        if( !mio0_decode_header( rom + offset, &head ))
+            continue;
+
+        // Skip anything that only looks like a header, the decoders trust their input
+        size_t left = romSize - offset;
+        if( head.dest_size == 0 || head.dest_size > 0x800000 || head.comp_offset >= left || head.uncomp_offset >= left )
+            continue;
+
+        uint8_t *refOut = malloc( head.dest_size );
+        uint8_t *fastOut = malloc( head.dest_size );
+        unsigned int refEnd = 0, fastEnd = 0;
+        int refResult, fastResult;
+
+        totalRef += time_decode( mio0_decode, rom + offset, refOut, &refEnd, &refResult );
+        totalFast += time_decode( mio0_decode_fast, rom + offset, fastOut, &fastEnd, &fastResult );
+        totalBytes += head.dest_size;
+        numBlocks++;
+
+        if( refResult != fastResult || refEnd != fastEnd || memcmp( refOut, fastOut, head.dest_size ) != 0 )
+        {
+            printf( "block at 0x%06zx (%u bytes) differs: result %d/%d, end %u/%u\n",
+                offset, head.dest_size, refResult, fastResult, refEnd, fastEnd );
+            numBad++;
+        }
+
+        free( refOut );
+        free( fastOut );
+    }
+
+    printf( "%u MIO0 blocks, %zu bytes decoded, %u mismatches\n", numBlocks, totalBytes, numBad );
+    if( numBlocks > 0 )
+        printf( "mio0_decode %.0f MB/s, mio0_decode_fast %.0f MB/s\n", totalBytes / totalRef / 1e3, totalBytes / totalFast / 1e3 );
+
+    free( rom );
+    return numBad > 0 || numBlocks == 0 ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+// Loopback of the net state delta encoding: the sender encodes every tick against the last state the
+// receiver acknowledged, the receiver decodes into its own copy of that baseline. Some packets are
+// dropped and acks arrive late, like they would over a real connection.
+
+#include <math.h>
+
+#include "bench.h"
+
+#define DEFAULT_TICKS 3000
+#define ACK_LATENCY 3  // Ticks before the sender hears about a received packet
+#define DROP_EVERY 7   // Every nth packet never arrives
+#define MAX_PACKET 64
+
+int main( int argc, char **argv )
+{
+    const char *romPath = argc > 1 ? argv[1] : "sm64.us.z64";
+    uint32_t numTicks = argc > 2 ? (uint32_t)atoi( argv[2] ) : DEFAULT_TICKS;
+    size_t romSize;
+
+    uint8_t *rom = bench_read_rom( romPath, &romSize );
+    if( !rom )
+        return 1;
+
+    uint8_t *texture = malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
+    sm64_global_init( rom, texture );
+    bench_load_level();
+
+    struct SM64MarioGeometryBuffers geometry;
+    struct SM64MarioInputs inputs;
+    struct SM64MarioState state;
+    bench_alloc_geometry( &geometry );
+
+    struct SM64MarioNetState *sent = malloc( sizeof( struct SM64MarioNetState ) * numTicks );
+    struct SM64MarioNetState *received = malloc( sizeof( struct SM64MarioNetState ) * numTicks );
+    bool *arrived = calloc( numTicks, sizeof( bool ));
+    int32_t acked = -1;
+
+    size_t deltaBytes = 0, fullBytes = 0;
+    uint32_t numReceived = 0, numErrors = 0;
+    float maxPosError = 0.0f, maxVelError = 0.0f, maxAngleError = 0.0f;
+    double encodeMs = 0.0, decodeMs = 0.0;
+
+    int32_t marioId = sm64_mario_create( 0.0f, 100.0f, 0.0f );
+
+    for( uint32_t tick = 0; tick < numTicks; ++tick )
+    {
+        bench_inputs_for( tick, &inputs );
+        sm64_mario_tick( marioId, &inputs, &state, &geometry );
+        sm64_mario_get_net_state( marioId, &sent[tick] );
+
+        // The ack for a packet shows up ACK_LATENCY ticks after it was sent
+        if( tick >= ACK_LATENCY && arrived[tick - ACK_LATENCY] )
+            acked = tick - ACK_LATENCY;
+
+        uint8_t packet[MAX_PACKET], fullPacket[MAX_PACKET];
+        fullBytes += sm64_net_state_encode( NULL, &sent[tick], fullPacket, MAX_PACKET );
+
+        double start = bench_now_ms();
+        uint32_t size = sm64_net_state_encode( acked >= 0 ? &sent[acked] : NULL, &sent[tick], packet, MAX_PACKET );
+        encodeMs += bench_now_ms() - start;
+        deltaBytes += size;
+
+        if( size == 0 )
+        {
+            numErrors++;
+            continue;
+        }
+
+        if( tick % DROP_EVERY == DROP_EVERY - 1 )
+            continue;
+
+        // The receiver only has the baseline when it got that packet, which the ack guarantees
+        struct SM64MarioNetState *out = &received[tick];
+        start = bench_now_ms();
+        uint32_t read = sm64_net_state_decode( acked >= 0 ? &received[acked] : NULL, packet, size, out );
+        decodeMs += bench_now_ms() - start;
+
+        arrived[tick] = true;
+        numReceived++;
+
+        const struct SM64MarioNetState *in = &sent[tick];
+        if( read != size || out->health != in->health || out->action != in->action || out->flags != in->flags ||
+            out->animID != in->animID || out->animFrame != in->animFrame )
+            numErrors++;
+
+        for( int i = 0; i < 3; ++i )
+        {
+            maxPosError = fmaxf( maxPosError, fabsf( out->position[i] - in->position[i] ));
+            maxVelError = fmaxf( maxVelError, fabsf( out->velocity[i] - in->velocity[i] ));
+        }
+        maxAngleError = fmaxf( maxAngleError, fabsf( out->faceAngle - in->faceAngle ));
+
+        // A truncated packet must never decode
+        struct SM64MarioNetState scratch;
+        if( size > 1 && sm64_net_state_decode( acked >= 0 ? &received[acked] : NULL, packet, size - 1, &scratch ) != 0 )
+            numErrors++;
+    }
+
+    // Quantization steps are 1/8 for positions and 1/64 for velocities, rounding is half of that
+    bool failed = numErrors > 0 || maxPosError > 0.5f / 8.0f + 1e-3f || maxVelError > 0.5f / 64.0f + 1e-4f || maxAngleError > 1e-3f;
+
+    printf( "%u ticks, %u received, %u errors\n", numTicks, numReceived, numErrors );
+    printf( "bytes/tick: %.2f delta, %.2f without baseline, %zu raw struct\n",
+        (double)deltaBytes / numTicks, (double)fullBytes / numTicks, sizeof( struct SM64MarioNetState ));
+    printf( "max round trip error: position %.4f, velocity %.5f, face angle %.5f\n", maxPosError, maxVelError, maxAngleError );
+    printf( "encode %.0f ns, decode %.0f ns per state\n", encodeMs * 1e6 / numTicks, decodeMs * 1e6 / numReceived );
+    printf( "%s\n", failed ? "FAILED" : "ok" );
+
+    sm64_mario_delete( marioId );
+    free( sent );
+    free( received );
+    free( arrived );
+    bench_free_geometry( &geometry );
+    sm64_global_terminate();
+    free( texture );
+    free( rom );
+    return failed ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,106 @@
+// Records a scripted session with setters and a moving platform, then plays the stream back headless
+// a few times. Every replay has to reproduce the recorded per-tick state hashes exactly.
+
+#include "bench.h"
+
+#define DEFAULT_TICKS 3000
+#define NUM_REPLAYS 3
+
+static void scripted_setters( int32_t marioId, uint32_t tick )
+{
+    switch( tick % 300 )
+    {
+        case 100: sm64_set_mario_velocity( marioId, 5.0f, 20.0f, -3.0f ); break;
+        case 150: sm64_mario_take_damage( marioId, 2, 0, 10.0f, 0.0f, 10.0f ); break;
+        case 200: sm64_set_mario_position( marioId, 100.0f, 300.0f, -50.0f ); break;
+        case 230: sm64_set_mario_health( marioId, 0x880 ); break;
+        case 260: sm64_mario_heal( marioId, 4 ); break;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    const char *romPath = argc > 1 ? argv[1] : "sm64.us.z64";
+    uint32_t numTicks = argc > 2 ? (uint32_t)atoi( argv[2] ) : DEFAULT_TICKS;
+    size_t romSize;
+
+    uint8_t *rom = bench_read_rom( romPath, &romSize );
+    if( !rom )
+        return 1;
+
+    uint8_t *texture = malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
+    sm64_global_init( rom, texture );
+    bench_load_level();
+
+    struct SM64MarioGeometryBuffers geometry;
+    struct SM64MarioInputs inputs;
+    struct SM64MarioState state;
+    bench_alloc_geometry( &geometry );
+
+    struct SM64Surface platform[2];
+    struct SM64SurfaceObject object;
+    memset( &object, 0, sizeof( struct SM64SurfaceObject ));
+    bench_add_quad( platform, -100, -100, 100, 100, 0 );
+    object.transform.position[0] = -600.0f;
+    object.transform.position[1] = 150.0f;
+    object.surfaceCount = 2;
+    object.surfaces = platform;
+
+    uint32_t *recorded = malloc( sizeof( uint32_t ) * numTicks );
+    uint32_t *replayed = malloc( sizeof( uint32_t ) * numTicks );
+
+    sm64_replay_record_start();
+    int32_t marioId = sm64_mario_create( 0.0f, 100.0f, 0.0f );
+    uint32_t objectId = sm64_surface_object_create( &object );
+
+    double start = bench_now_ms();
+    for( uint32_t tick = 0; tick < numTicks; ++tick )
+    {
+        bench_inputs_for( tick, &inputs );
+        scripted_setters( marioId, tick );
+
+        if( tick % 10 == 0 )
+        {
+            object.transform.eulerRotation[1] += 5.0f;
+            sm64_surface_object_move( objectId, &object.transform );
+        }
+
+        sm64_mario_tick( marioId, &inputs, &state, &geometry );
+        recorded[tick] = sm64_mario_state_hash( &state );
+    }
+    double liveMs = bench_now_ms() - start;
+
+    sm64_mario_delete( marioId );
+    sm64_surface_object_delete( objectId );
+
+    size_t streamSize;
+    const uint8_t *stream = sm64_replay_record_stop( &streamSize );
+    printf( "recorded %u ticks, %zu byte stream (%.1f bytes/tick), %.0f ticks/s live\n",
+        numTicks, streamSize, (double)streamSize / numTicks, numTicks / liveMs * 1e3 );
+
+    bool failed = false;
+    for( int run = 0; run < NUM_REPLAYS; ++run )
+    {
+        int32_t mismatch;
+        memset( replayed, 0, sizeof( uint32_t ) * numTicks );
+
+        start = bench_now_ms();
+        uint32_t replayedTicks = sm64_replay_run( stream, streamSize, replayed, numTicks, &mismatch );
+        double replayMs = bench_now_ms() - start;
+
+        bool same = replayedTicks == numTicks && mismatch < 0 && !memcmp( recorded, replayed, sizeof( uint32_t ) * numTicks );
+        failed |= !same;
+        printf( "replay %d: %u ticks, %s, %.0f ticks/s\n", run, replayedTicks,
+            same ? "hashes match" : "MISMATCH", replayedTicks / replayMs * 1e3 );
+        if( !same && mismatch >= 0 )
+            printf( "  first mismatch at tick %d\n", mismatch );
+    }
+
+    free( recorded );
+    free( replayed );
+    bench_free_geometry( &geometry );
+    sm64_global_terminate();
+    free( texture );
+    free( rom );
+    return failed ? 1 : 0;
+}
\ No newline at end of file
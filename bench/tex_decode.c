@@ -0,0 +1,152 @@
+// Checks decode_rgba5551 against the raw2rgba reference for every 16 bit value and every flag
+// combination, times it, and when a ROM is given times each startup stage it sits between.
+
+#include "bench.h"
+#include "load_tex_data.h"
+#include "load_anim_data.h"
+#include "decomp/tools/libmio0.h"
+#include "decomp/tools/n64graphics.h"
+
+#define NUM_VALUES 0x10000
+#define NUM_REPS 20
+
+static const uint32_t s_flag_combos[] = { 0, SM64_TEXTURE_PREMULTIPLIED_ALPHA, SM64_TEXTURE_BGRA, SM64_TEXTURE_PREMULTIPLIED_ALPHA | SM64_TEXTURE_BGRA };
+
+static bool check_exhaustive( const uint8_t *raw, const rgba *ref, uint8_t *out )
+{
+    bool ok = true;
+
+    for( int f = 0; f < 4; ++f )
+    {
+        uint32_t flags = s_flag_combos[f];
+        uint32_t numBad = 0;
+
+        // Odd starts and lengths so every SIMD tail and alignment gets hit too
+        for( int offset = 0; offset < 4; ++offset )
+        {
+            int count = NUM_VALUES - 4 * offset;
+            memset( out, 0xCD, 4 * NUM_VALUES + 4 );
+            decode_rgba5551( raw + 2 * offset, out, count, flags );
+
+            for( int i = 0; i < count; ++i )
+            {
+                const rgba *p = &ref[offset + i];
+                uint8_t mask = ( flags & SM64_TEXTURE_PREMULTIPLIED_ALPHA ) ? p->alpha : 0xFF;
+                uint8_t r = p->red & mask, g = p->green & mask, b = p->blue & mask;
+                const uint8_t *o = out + 4 * i;
+
+                if( ( flags & SM64_TEXTURE_BGRA ) ? ( o[0] != b || o[2] != r ) : ( o[0] != r || o[2] != b ))
+                    numBad++;
+                else if( o[1] != g || o[3] != p->alpha )
+                    numBad++;
+            }
+
+            if( out[4 * count] != 0xCD )
+                numBad++;
+        }
+
+        printf( "flags %u: %u mismatches\n", flags, numBad );
+        ok &= numBad == 0;
+    }
+
+    return ok;
+}
+
+static double time_stage( const char *name, void (*stage)( const uint8_t * ), const uint8_t *rom )
+{
+    double best = 1e9;
+    for( int rep = 0; rep < NUM_REPS; ++rep )
+    {
+        double start = bench_now_ms();
+        stage( rom );
+        double ms = bench_now_ms() - start;
+        if( ms < best )
+            best = ms;
+    }
+    printf( "  %-22s %8.3f ms\n", name, best );
+    return best;
+}
+
+static uint8_t *s_texture;
+
+static void stage_mio0( const uint8_t *rom )
+{
+    mio0_header_t head;
+    mio0_decode_header( rom + MARIO_TEX_ROM_OFFSET, &head );
+    uint8_t *out = malloc( head.dest_size );
+    mio0_decode_fast( rom + MARIO_TEX_ROM_OFFSET, out, NULL );
+    free( out );
+}
+
+static void stage_textures( const uint8_t *rom )
+{
+    load_mario_textures_from_rom( rom, s_texture, 0 );
+}
+
+static void stage_anims( const uint8_t *rom )
+{
+    load_mario_anims_from_rom( rom );
+    unload_mario_anims();
+}
+
+static void stage_global_init( const uint8_t *rom )
+{
+    sm64_global_init( rom, s_texture );
+    sm64_global_terminate();
+}
+
+int main( int argc, char **argv )
+{
+    uint8_t *raw = malloc( 2 * NUM_VALUES );
+    uint8_t *out = malloc( 4 * NUM_VALUES + 4 );
+
+    for( int i = 0; i < NUM_VALUES; ++i )
+    {
+        raw[2 * i] = (uint8_t)( i >> 8 );
+        raw[2 * i + 1] = (uint8_t)i;
+    }
+
+    rgba *ref = raw2rgba( raw, NUM_VALUES, 1, 16 );
+    bool ok = check_exhaustive( raw, ref, out );
+
+    double best = 1e9, bestRef = 1e9;
+    for( int rep = 0; rep < NUM_REPS; ++rep )
+    {
+        double start = bench_now_ms();
+        decode_rgba5551( raw, out, NUM_VALUES, 0 );
+        double ms = bench_now_ms() - start;
+        if( ms < best )
+            best = ms;
+
+        start = bench_now_ms();
+        rgba *pixels = raw2rgba( raw, NUM_VALUES, 1, 16 );
+        ms = bench_now_ms() - start;
+        free( pixels );
+        if( ms < bestRef )
+            bestRef = ms;
+    }
+    printf( "decode_rgba5551 %.0f Mpixels/s, raw2rgba %.0f Mpixels/s\n", NUM_VALUES / best / 1e3, NUM_VALUES / bestRef / 1e3 );
+
+    free( ref );
+    free( raw );
+    free( out );
+
+    size_t romSize;
+    uint8_t *rom = argc > 1 ? bench_read_rom( argv[1], &romSize ) : NULL;
+    if( rom )
+    {
+        s_texture = malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
+        printf( "startup stages, best of %d:\n", NUM_REPS );
+        time_stage( "texture mio0", stage_mio0, rom );
+        time_stage( "textures (incl. mio0)", stage_textures, rom );
+        time_stage( "animations", stage_anims, rom );
+        time_stage( "sm64_global_init", stage_global_init, rom );
+        free( s_texture );
+        free( rom );
+    }
+    else
+        printf( "no ROM, startup stages skipped\n" );
+
+    printf( "%s\n", ok ? "ok" : "FAILED" );
+    return ok ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,163 @@
+#include "anim_pose_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "decomp/engine/graph_node.h"
+#include "decomp/engine/math_util.h"
+
+// Every frame of one animation, most recently used entries first. Looking up the current
+// animation is usually a hit on the head of the list.
+struct AnimPoseCacheEntry
+{
+    struct Animation *anim;
+    struct AnimPoseCacheEntry *prev;
+    struct AnimPoseCacheEntry *next;
+    size_t size;
+    u32 numFrames;
+    u32 frameStride;
+    u8 poses[];
+};
+
+static size_t s_budget = 0;
+static size_t s_used = 0;
+static struct AnimPoseCacheEntry *s_head = NULL;
+static struct AnimPoseCacheEntry *s_tail = NULL;
+
+static void unlink_entry( struct AnimPoseCacheEntry *entry )
+{
+    if( entry->prev ) entry->prev->next = entry->next; else s_head = entry->next;
+    if( entry->next ) entry->next->prev = entry->prev; else s_tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void push_front( struct AnimPoseCacheEntry *entry )
+{
+    entry->prev = NULL;
+    entry->next = s_head;
+    if( s_head ) s_head->prev = entry; else s_tail = entry;
+    s_head = entry;
+}
+
+// Stops short of keep, the pose of the object holding the one being decoded may still be in use
+static void evict_until_fits( size_t size, struct AnimPoseCacheEntry *keep )
+{
+    while( s_tail != NULL && s_tail != keep && s_used + size > s_budget )
+    {
+        struct AnimPoseCacheEntry *entry = s_tail;
+        unlink_entry( entry );
+        s_used -= entry->size;
+        free( entry );
+    }
+}
+
+static struct AnimPose *entry_pose( struct AnimPoseCacheEntry *entry, u32 frame )
+{
+    return (struct AnimPose *)( entry->poses + (size_t)frame * entry->frameStride );
+}
+
+static struct AnimPoseCacheEntry *decode_animation( struct Animation *anim )
+{
+    if( anim->indexLength < 12 )
+        return NULL;
+
+    // Frames past the longest attribute all clamp to its last value, so that's all there is to store
+    u32 numParts = anim->indexLength / 6 - 1;
+    u32 numFrames = 0;
+    for( u32 i = 0; i < anim->indexLength; i += 2 )
+        if( anim->index[i] > numFrames )
+            numFrames = anim->index[i];
+
+    if( numFrames == 0 )
+        return NULL;
+
+    u32 frameStride = ( sizeof( struct AnimPose ) + numParts * sizeof( f32[3][3] ) + 7 ) & ~7u;
+    size_t size = sizeof( struct AnimPoseCacheEntry ) + (size_t)numFrames * frameStride;
+
+    if( size > s_budget )
+        return NULL;
+
+    evict_until_fits( size, s_head );
+    if( s_used + size > s_budget )
+        return NULL;
+
+    struct AnimPoseCacheEntry *entry = malloc( size );
+    entry->anim = anim;
+    entry->size = size;
+    entry->numFrames = numFrames;
+    entry->frameStride = frameStride;
+
+    for( u32 frame = 0; frame < numFrames; ++frame )
+    {
+        struct AnimPose *pose = entry_pose( entry, frame );
+        u16 *attribute = anim->index;
+
+        pose->numParts = (u16)numParts;
+        pose->translation[0] = anim->values[retrieve_animation_index( frame, &attribute )];
+        pose->translation[1] = anim->values[retrieve_animation_index( frame, &attribute )];
+        pose->translation[2] = anim->values[retrieve_animation_index( frame, &attribute )];
+
+        for( u32 part = 0; part < numParts; ++part )
+        {
+            Mat4 matrix;
+            Vec3f translation = { 0.0f, 0.0f, 0.0f };
+            Vec3s rotation;
+
+            rotation[0] = anim->values[retrieve_animation_index( frame, &attribute )];
+            rotation[1] = anim->values[retrieve_animation_index( frame, &attribute )];
+            rotation[2] = anim->values[retrieve_animation_index( frame, &attribute )];
+            mtxf_rotate_xyz_and_translate( matrix, translation, rotation );
+
+            for( int i = 0; i < 3; ++i )
+                for( int j = 0; j < 3; ++j )
+                    pose->rotations[part][i][j] = matrix[i][j];
+        }
+    }
+
+    s_used += size;
+    push_front( entry );
+    return entry;
+}
+
+void anim_pose_cache_set_budget( size_t bytes )
+{
+    s_budget = bytes;
+    evict_until_fits( 0, NULL );
+}
+
+const struct AnimPose *anim_pose_cache_get( struct Animation *anim, s32 frame )
+{
+    if( s_budget == 0 || anim == NULL || frame < 0 )
+        return NULL;
+
+    struct AnimPoseCacheEntry *entry = s_head;
+    while( entry != NULL && entry->anim != anim )
+        entry = entry->next;
+
+    if( entry == NULL )
+    {
+        entry = decode_animation( anim );
+        if( entry == NULL )
+            return NULL;
+    }
+    else if( entry != s_head )
+    {
+        unlink_entry( entry );
+        push_front( entry );
+    }
+
+    return entry_pose( entry, (u32)frame < entry->numFrames ? (u32)frame : entry->numFrames - 1 );
+}
+
+void anim_pose_cache_clear( void )
+{
+    while( s_head != NULL )
+    {
+        struct AnimPoseCacheEntry *entry = s_head;
+        unlink_entry( entry );
+        free( entry );
+    }
+
+    s_used = 0;
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "decomp/include/types.h"
+
+// One frame of an animation decoded for every animated part: the root translation values as
+// stored in the animation, and each part's rotation as the 3x3 block of the matrix
+// geo_push_animated_part would otherwise build from the euler angles.
+struct AnimPose
+{
+    s16 translation[3];
+    u16 numParts;
+    f32 rotations[][3][3];
+};
+
+extern void anim_pose_cache_set_budget( size_t bytes );
+extern const struct AnimPose *anim_pose_cache_get( struct Animation *anim, s32 frame );
+extern void anim_pose_cache_clear( void );
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "asset_cache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "libsm64.h"
+#include "file_map.h"
+#include "load_anim_data.h"
+#include "debug_print.h"
+
+#define ASSET_CACHE_MAGIC 0x43344D53 // "SM4C"
+#define ASSET_CACHE_VERSION 3
+#define ASSET_CACHE_ALIGNMENT 64
+#define ASSET_CACHE_ATLAS_SIZE ( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT )
+
+// The decoded data is stored in host byte order, so the magic also rejects caches written on a
+// machine of the other endianness.
+struct AssetCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t romHash;
+    uint32_t atlasFlags;
+    uint32_t atlasOffset;
+    uint32_t atlasSize;
+    uint32_t animsOffset;
+    uint32_t animsSize;
+};
+
+static struct FileMap s_map;
+
+static size_t align_up( size_t x )
+{
+    return ( x + ASSET_CACHE_ALIGNMENT - 1 ) & ~(size_t)( ASSET_CACHE_ALIGNMENT - 1 );
+}
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ull
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4Full
+
+static uint64_t hash_round( uint64_t lane, uint64_t word )
+{
+    lane += word * HASH_PRIME_2;
+    lane = ( lane << 31 ) | ( lane >> 33 );
+    return lane * HASH_PRIME_1;
+}
+
+// The CRC in the ROM header only covers 1MB near the start, which has neither the textures nor
+// the animations in it, so the whole ROM is hashed instead. Four independent lanes keep this to
+// well under a millisecond.
+static uint64_t rom_hash( const uint8_t *rom )
+{
+    uint64_t lanes[4] = { HASH_PRIME_1, HASH_PRIME_2, 0, ~HASH_PRIME_1 };
+
+    for( size_t i = 0; i < SM64_ROM_SIZE; i += 32 )
+    {
+        for( int k = 0; k < 4; ++k )
+        {
+            uint64_t word;
+            memcpy( &word, rom + i + 8 * k, sizeof( word ));
+            lanes[k] = hash_round( lanes[k], word );
+        }
+    }
+
+    uint64_t hash = 0;
+    for( int k = 0; k < 4; ++k )
+        hash = hash_round( hash, lanes[k] );
+    return hash ^ ( hash >> 29 );
+}
+
+bool asset_cache_load( const char *path, const uint8_t *rom, uint8_t *outTexture, uint32_t textureFlags )
+{
+    asset_cache_terminate();
+
+    if( !file_map_open( &s_map, path ))
+        return false;
+
+    const struct AssetCacheHeader *header = (const struct AssetCacheHeader *)s_map.data;
+
+    if( s_map.size < sizeof( struct AssetCacheHeader ) ||
+        header->magic != ASSET_CACHE_MAGIC ||
+        header->version != ASSET_CACHE_VERSION ||
+        header->romHash != rom_hash( rom ) ||
+        header->atlasFlags != textureFlags ||
+        header->atlasSize != ASSET_CACHE_ATLAS_SIZE ||
+        (size_t)header->atlasOffset + header->atlasSize > s_map.size ||
+        (size_t)header->animsOffset + header->animsSize > s_map.size ||
+        header->animsOffset % ASSET_CACHE_ALIGNMENT != 0 )
+    {
+        DEBUG_PRINT("Asset cache %s is stale or invalid, rebuilding it", path);
+        asset_cache_terminate();
+        return false;
+    }
+
+    if( !load_mario_anims_from_cache( s_map.data + header->animsOffset, header->animsSize ))
+    {
+        asset_cache_terminate();
+        return false;
+    }
+
+    memcpy( outTexture, s_map.data + header->atlasOffset, header->atlasSize );
+    return true;
+}
+
+bool asset_cache_save( const char *path, const uint8_t *rom, const uint8_t *texture, uint32_t textureFlags )
+{
+    struct AssetCacheHeader header;
+    memset( &header, 0, sizeof( header ));
+
+    header.magic = ASSET_CACHE_MAGIC;
+    header.version = ASSET_CACHE_VERSION;
+    header.romHash = rom_hash( rom );
+    header.atlasFlags = textureFlags;
+    header.atlasOffset = (uint32_t)align_up( sizeof( header ));
+    header.atlasSize = ASSET_CACHE_ATLAS_SIZE;
+    header.animsOffset = (uint32_t)align_up( header.atlasOffset + header.atlasSize );
+    header.animsSize = (uint32_t)save_mario_anims( NULL );
+
+    size_t size = header.animsOffset + header.animsSize;
+    uint8_t *data = calloc( 1, size );
+    memcpy( data, &header, sizeof( header ));
+    memcpy( data + header.atlasOffset, texture, header.atlasSize );
+    save_mario_anims( data + header.animsOffset );
+
+    // Other processes may have the current file mapped, so it's never rewritten in place. The new
+    // one is written next to it and swapped in whole.
+    size_t pathLength = strlen( path );
+    char *tempPath = malloc( pathLength + 5 );
+    memcpy( tempPath, path, pathLength );
+    memcpy( tempPath + pathLength, ".tmp", 5 );
+
+    FILE *f = fopen( tempPath, "wb" );
+    bool ok = f && fwrite( data, 1, size, f ) == size;
+    if( f && fclose( f ) != 0 )
+        ok = false;
+
+#ifdef _WIN32
+    if( ok && !MoveFileExA( tempPath, path, MOVEFILE_REPLACE_EXISTING ))
+        ok = false;
+#else
+    if( ok && rename( tempPath, path ) != 0 )
+        ok = false;
+#endif
+
+    if( f && !ok )
+        remove( tempPath );
+
+    if( !ok )
+        DEBUG_PRINT("Failed to write asset cache %s", path);
+
+    free( tempPath );
+    free( data );
+    return ok;
+}
+
+void asset_cache_terminate( void )
+{
+    file_map_close( &s_map );
+}
\ No newline at end of file
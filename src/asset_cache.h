@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+extern bool asset_cache_load( const char *path, const uint8_t *rom, uint8_t *outTexture, uint32_t textureFlags );
+extern bool asset_cache_save( const char *path, const uint8_t *rom, const uint8_t *texture, uint32_t textureFlags );
+extern void asset_cache_terminate( void );
\ No newline at end of file
@@ -116,7 +116,11 @@ struct GraphNodePerspective
  */
 struct DisplayListNode
 {
+#ifdef GBI_FLOATS
+    Mat4 transform; // libsm64: copied from gMatStack, the adapter reads it directly
+#else
     Mtx *transform;
+#endif
     void *displayList;
     struct DisplayListNode *next;
 };
@@ -2,6 +2,7 @@
 #include "surface_collision.h"
 #include "../include/surface_terrains.h"
 #include "../../load_surfaces.h"
+#include "../../profile.h"
 
 /**
  * Iterate through the list of ceilings and find the first ceiling over a given point.
@@ -306,14 +307,18 @@ s32 find_wall_collisions(struct SM64WallCollisionData *colData)
     //     return numCollisions;
     // }
 
+    PROFILE_BEGIN(SM64_PROFILE_PHASE_COLLISION); // libsm64: profiling
     numCollisions += find_wall_collisions_from_list(colData);
+    PROFILE_END(SM64_PROFILE_PHASE_COLLISION);
     return numCollisions;
 }
 
 f32 find_ceil(f32 posX, f32 posY, f32 posZ, struct SM64SurfaceCollisionData **pceil)
 {
     f32 height = CELL_HEIGHT_LIMIT;
+    PROFILE_BEGIN(SM64_PROFILE_PHASE_COLLISION); // libsm64: profiling
 	*pceil = find_ceil_from_list( posX, posY, posZ, &height );
+    PROFILE_END(SM64_PROFILE_PHASE_COLLISION);
 	return height;
 }
 
@@ -340,14 +345,18 @@ f32 find_floor_height_and_data(f32 xPos, f32 yPos, f32 zPos, struct SM64FloorCol
 f32 find_floor_height(f32 x, f32 y, f32 z)
 {
     f32 height = FLOOR_LOWER_LIMIT;
+    PROFILE_BEGIN(SM64_PROFILE_PHASE_COLLISION); // libsm64: profiling
 	find_floor_from_list( x, y, z, &height );
+    PROFILE_END(SM64_PROFILE_PHASE_COLLISION);
 	return height;
 }
 
 f32 find_floor(f32 xPos, f32 yPos, f32 zPos, struct SM64SurfaceCollisionData **pfloor)
 {
     f32 height = FLOOR_LOWER_LIMIT;
+    PROFILE_BEGIN(SM64_PROFILE_PHASE_COLLISION); // libsm64: profiling
 	*pfloor = find_floor_from_list( xPos, yPos, zPos, &height );
+    PROFILE_END(SM64_PROFILE_PHASE_COLLISION);
 	return height;
 }
 
@@ -60,17 +60,18 @@
 static Vec3f gVec3fZero = { 0.0f, 0.0f, 0.0f };
 static Vec3s gVec3sZero = { 0, 0, 0 };
 
-static struct Object *try_allocate_object(void) {
+// libsm64: the object lives in its Mario instance's slab instead of the object pool
+static struct Object *try_allocate_object(struct Object *storage) {
     struct ObjectNode *nextObj;
-    nextObj = (struct ObjectNode *) malloc(sizeof(struct Object));
+    nextObj = (struct ObjectNode *) storage;
     nextObj->prev = NULL;
     nextObj->next = NULL;
     return (struct Object *) nextObj;
 }
 
-static struct Object *allocate_object(void) {
+static struct Object *allocate_object(struct Object *storage) {
     s32 i;
-    struct Object *obj = try_allocate_object();
+    struct Object *obj = try_allocate_object(storage);
 
     // Initialize object fields
 
@@ -130,9 +131,9 @@ static struct Object *allocate_object(void) {
     return obj;
 }
 
-static struct Object *create_object(void) {
+static struct Object *create_object(struct Object *storage) {
     struct Object *obj;
-    obj = allocate_object();
+    obj = allocate_object(storage);
     obj->curBhvCommand = NULL;
     obj->behavior = NULL;
     return obj;
@@ -154,9 +155,9 @@ static void geo_obj_init(struct GraphNodeObject *graphNode, void *sharedChild, V
     graphNode->node.flags &= ~GRAPH_RENDER_BILLBOARD;
 }
 
-static struct Object *spawn_object_at_origin(void) {
+static struct Object *spawn_object_at_origin(struct Object *storage) {
     struct Object *obj;
-    obj = create_object();
+    obj = create_object(storage);
 
     obj->parentObj = NULL;
     obj->header.gfx.areaIndex = 0;
@@ -198,9 +199,9 @@ static void copy_mario_state_to_object(void) {
     gCurrentObject->oAngleVelRoll = gMarioState->angleVel[2];
 }
 
-struct Object *hack_allocate_mario(void)
+struct Object *hack_allocate_mario(struct Object *storage)
 {
-    return spawn_object_at_origin();
+    return spawn_object_at_origin(storage);
 }
 
 /**
@@ -2,7 +2,7 @@
 
 #include "../include/types.h"
 
-struct Object *hack_allocate_mario(void);
+struct Object *hack_allocate_mario(struct Object *storage);
 void bhv_mario_update(void);
 void create_transformation_from_matrices(Mat4 a0, Mat4 a1, Mat4 a2);
 void obj_update_pos_from_parent_transformation(Mat4 a0, struct Object *a1);
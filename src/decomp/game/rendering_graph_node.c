@@ -1,5 +1,7 @@
 #define NO_SEGMENTED_MEMORY
 
+#include <stdlib.h>
+
 #include "../include/PR/gbi.h"
 #include "../include/PR/ultratypes.h"
 
@@ -15,6 +17,7 @@
 #include "../include/sm64.h"
 #include "../shim.h"
 #include "../../gfx_adapter.h"
+#include "../../anim_pose_cache.h"
 
 
 
@@ -58,6 +61,20 @@ s16 gMatStackIndex;
 Mat4 gMatStack[32];
 Mtx *gMatStackFixed[32];
 
+/**
+ * libsm64: Pushes the top of gMatStack onto the fixed point stack. With GBI_FLOATS the adapter
+ * takes the float matrices directly (see geo_append_display_list), so there's nothing to convert
+ * or allocate and gMatStackFixed is left unused.
+ */
+static void geo_update_fixed_matrix(void) {
+#ifndef GBI_FLOATS
+    Mtx *mtx = alloc_display_list(sizeof(*mtx));
+
+    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
+    gMatStackFixed[gMatStackIndex] = mtx;
+#endif
+}
+
 /**
  * Animation nodes have state in global variables, so this struct captures
  * the animation state so a 'context switch' can be made when rendering the
@@ -70,6 +87,8 @@ struct GeoAnimState {
     /*0x04*/ f32 translationMultiplier;
     /*0x08*/ u16 *attribute;
     /*0x0C*/ s16 *data;
+    const struct AnimPose *pose; // libsm64: added field
+    u16 posePart; // libsm64: added field
 };
 
 // For some reason, this is a GeoAnimState struct, but the current state consists
@@ -83,6 +102,10 @@ f32 gCurAnimTranslationMultiplier;
 u16 *gCurrAnimAttribute;
 s16 *gCurAnimData;
 
+// libsm64: the current frame from the pose cache when the animation is in it, and the next part to take from it
+const struct AnimPose *gCurAnimPose;
+u16 gCurAnimPosePart;
+
 struct AllocOnlyPool *gDisplayListHeap;
 
 struct RenderModeContainer {
@@ -183,8 +206,12 @@ static void geo_process_master_list_sub(struct GraphNodeMasterList *node) {
                     continue;
                 }
 
+#ifdef GBI_FLOATS
+                gSPMatrixF(gDisplayListHead++, &currList->transform);
+#else
                 gSPMatrix(gDisplayListHead++, VIRTUAL_TO_PHYSICAL(currList->transform),
                           G_MTX_MODELVIEW | G_MTX_LOAD | G_MTX_NOPUSH);
+#endif
                 gSPDisplayList(gDisplayListHead++, currList->displayList);
                 currList = currList->next;
             }
@@ -210,7 +237,11 @@ static void geo_append_display_list(void *displayList, s16 layer) {
         struct DisplayListNode *listNode =
             alloc_only_pool_alloc(gDisplayListHeap, sizeof(struct DisplayListNode));
 
+#ifdef GBI_FLOATS
+        mtxf_copy(listNode->transform, gMatStack[gMatStackIndex]);
+#else
         listNode->transform = gMatStackFixed[gMatStackIndex];
+#endif
         listNode->displayList = displayList;
         listNode->next = 0;
         if (gCurGraphNodeMasterList->listHeads[layer] == 0) {
@@ -223,17 +254,26 @@ static void geo_append_display_list(void *displayList, s16 layer) {
 }
 
 /**
- * Process the master list node.
+ * Start collecting display lists into the master list node, unless one is already being collected.
  */
-static void geo_process_master_list(struct GraphNodeMasterList *node) {
+static s32 geo_enter_master_list(struct GraphNodeMasterList *node) {
     s32 i;
-    UNUSED s32 sp1C;
 
     if (gCurGraphNodeMasterList == NULL && node->node.children != NULL) {
         gCurGraphNodeMasterList = node;
         for (i = 0; i < GFX_NUM_MASTER_LISTS; i++) {
             node->listHeads[i] = NULL;
         }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Process the master list node.
+ */
+static void geo_process_master_list(struct GraphNodeMasterList *node) {
+    if (geo_enter_master_list(node)) {
         geo_process_node_and_siblings(node->node.children);
         geo_process_master_list_sub(node);
         gCurGraphNodeMasterList = NULL;
@@ -288,15 +328,12 @@ static void geo_process_perspective(struct GraphNodePerspective *node) {
 }
 
 /**
- * Process a level of detail node. From the current transformation matrix,
- * the perpendicular distance to the camera is extracted and the children
- * of this node are only processed if that distance is within the render
- * range of this node.
+ * Whether the distance to the camera, taken from the current transformation matrix, is within
+ * the render range of a level of detail node.
  */
-static void geo_process_level_of_detail(struct GraphNodeLevelOfDetail *node) {
+static s32 geo_level_of_detail_in_range(struct GraphNodeLevelOfDetail *node) {
 #ifdef GBI_FLOATS
-    Mtx *mtx = gMatStackFixed[gMatStackIndex];
-    s16 distanceFromCam = (s32) -mtx->m[3][2]; // z-component of the translation column
+    s16 distanceFromCam = (s32) -gMatStack[gMatStackIndex][3][2]; // z-component of the translation column
 #else
     // The fixed point Mtx type is defined as 16 longs, but it's actually 16
     // shorts for the integer parts followed by 16 shorts for the fraction parts
@@ -309,7 +346,17 @@ static void geo_process_level_of_detail(struct GraphNodeLevelOfDetail *node) {
     distanceFromCam = 0;
 #endif
 
-    if (node->minDistance <= distanceFromCam && distanceFromCam < node->maxDistance) {
+    return node->minDistance <= distanceFromCam && distanceFromCam < node->maxDistance;
+}
+
+/**
+ * Process a level of detail node. From the current transformation matrix,
+ * the perpendicular distance to the camera is extracted and the children
+ * of this node are only processed if that distance is within the render
+ * range of this node.
+ */
+static void geo_process_level_of_detail(struct GraphNodeLevelOfDetail *node) {
+    if (geo_level_of_detail_in_range(node)) {
         if (node->node.children != 0) {
             geo_process_node_and_siblings(node->node.children);
         }
@@ -342,7 +389,6 @@ static void geo_process_switch(struct GraphNodeSwitchCase *node) {
 static void geo_process_camera(struct GraphNodeCamera *node) {
     Mat4 cameraTransform;
     Mtx *rollMtx = alloc_display_list(sizeof(*rollMtx));
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
     if (node->fnNode.func != NULL) {
         node->fnNode.func(GEO_CONTEXT_RENDER, &node->fnNode.node, gMatStack[gMatStackIndex]);
@@ -354,8 +400,7 @@ static void geo_process_camera(struct GraphNodeCamera *node) {
     mtxf_lookat(cameraTransform, node->pos, node->focus, node->roll);
     mtxf_mul(gMatStack[gMatStackIndex + 1], cameraTransform, gMatStack[gMatStackIndex]);
     gMatStackIndex++;
-    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = mtx;
+    geo_update_fixed_matrix();
     if (node->fnNode.node.children != 0) {
         gCurGraphNodeCamera = node;
         node->matrixPtr = &gMatStack[gMatStackIndex];
@@ -366,25 +411,30 @@ static void geo_process_camera(struct GraphNodeCamera *node) {
 }
 
 /**
- * Process a translation / rotation node. A transformation matrix based
- * on the node's translation and rotation is created and pushed on both
- * the float and fixed point matrix stacks.
- * For the rest it acts as a normal display list node.
+ * Push the transformation of a translation / rotation node and append its display list.
  */
-static void geo_process_translation_rotation(struct GraphNodeTranslationRotation *node) {
+static void geo_push_translation_rotation(struct GraphNodeTranslationRotation *node) {
     Mat4 mtxf;
     Vec3f translation;
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
     vec3s_to_vec3f(translation, node->translation);
     mtxf_rotate_zxy_and_translate(mtxf, translation, node->rotation);
     mtxf_mul(gMatStack[gMatStackIndex + 1], mtxf, gMatStack[gMatStackIndex]);
     gMatStackIndex++;
-    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = mtx;
+    geo_update_fixed_matrix();
     if (node->displayList != NULL) {
         geo_append_display_list(node->displayList, node->node.flags >> 8);
     }
+}
+
+/**
+ * Process a translation / rotation node. A transformation matrix based
+ * on the node's translation and rotation is created and pushed on both
+ * the float and fixed point matrix stacks.
+ * For the rest it acts as a normal display list node.
+ */
+static void geo_process_translation_rotation(struct GraphNodeTranslationRotation *node) {
+    geo_push_translation_rotation(node);
     if (node->node.children != NULL) {
         geo_process_node_and_siblings(node->node.children);
     }
@@ -392,24 +442,29 @@ static void geo_process_translation_rotation(struct GraphNodeTranslationRotation
 }
 
 /**
- * Process a translation node. A transformation matrix based on the node's
- * translation is created and pushed on both the float and fixed point matrix stacks.
- * For the rest it acts as a normal display list node.
+ * Push the transformation of a translation node and append its display list.
  */
-static void geo_process_translation(struct GraphNodeTranslation *node) {
+static void geo_push_translation(struct GraphNodeTranslation *node) {
     Mat4 mtxf;
     Vec3f translation;
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
     vec3s_to_vec3f(translation, node->translation);
     mtxf_rotate_zxy_and_translate(mtxf, translation, gVec3sZero);
     mtxf_mul(gMatStack[gMatStackIndex + 1], mtxf, gMatStack[gMatStackIndex]);
     gMatStackIndex++;
-    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = mtx;
+    geo_update_fixed_matrix();
     if (node->displayList != NULL) {
         geo_append_display_list(node->displayList, node->node.flags >> 8);
     }
+}
+
+/**
+ * Process a translation node. A transformation matrix based on the node's
+ * translation is created and pushed on both the float and fixed point matrix stacks.
+ * For the rest it acts as a normal display list node.
+ */
+static void geo_process_translation(struct GraphNodeTranslation *node) {
+    geo_push_translation(node);
     if (node->node.children != NULL) {
         geo_process_node_and_siblings(node->node.children);
     }
@@ -417,22 +472,27 @@ static void geo_process_translation(struct GraphNodeTranslation *node) {
 }
 
 /**
- * Process a rotation node. A transformation matrix based on the node's
- * rotation is created and pushed on both the float and fixed point matrix stacks.
- * For the rest it acts as a normal display list node.
+ * Push the transformation of a rotation node and append its display list.
  */
-static void geo_process_rotation(struct GraphNodeRotation *node) {
+static void geo_push_rotation(struct GraphNodeRotation *node) {
     Mat4 mtxf;
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
     mtxf_rotate_zxy_and_translate(mtxf, gVec3fZero, node->rotation);
     mtxf_mul(gMatStack[gMatStackIndex + 1], mtxf, gMatStack[gMatStackIndex]);
     gMatStackIndex++;
-    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = mtx;
+    geo_update_fixed_matrix();
     if (node->displayList != NULL) {
         geo_append_display_list(node->displayList, node->node.flags >> 8);
     }
+}
+
+/**
+ * Process a rotation node. A transformation matrix based on the node's
+ * rotation is created and pushed on both the float and fixed point matrix stacks.
+ * For the rest it acts as a normal display list node.
+ */
+static void geo_process_rotation(struct GraphNodeRotation *node) {
+    geo_push_rotation(node);
     if (node->node.children != NULL) {
         geo_process_node_and_siblings(node->node.children);
     }
@@ -440,23 +500,28 @@ static void geo_process_rotation(struct GraphNodeRotation *node) {
 }
 
 /**
- * Process a scaling node. A transformation matrix based on the node's
- * scale is created and pushed on both the float and fixed point matrix stacks.
- * For the rest it acts as a normal display list node.
+ * Push the transformation of a scale node and append its display list.
  */
-static void geo_process_scale(struct GraphNodeScale *node) {
+static void geo_push_scale(struct GraphNodeScale *node) {
     UNUSED Mat4 transform;
     Vec3f scaleVec;
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
     vec3f_set(scaleVec, node->scale, node->scale, node->scale);
     mtxf_scale_vec3f(gMatStack[gMatStackIndex + 1], gMatStack[gMatStackIndex], scaleVec);
     gMatStackIndex++;
-    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = mtx;
+    geo_update_fixed_matrix();
     if (node->displayList != NULL) {
         geo_append_display_list(node->displayList, node->node.flags >> 8);
     }
+}
+
+/**
+ * Process a scaling node. A transformation matrix based on the node's
+ * scale is created and pushed on both the float and fixed point matrix stacks.
+ * For the rest it acts as a normal display list node.
+ */
+static void geo_process_scale(struct GraphNodeScale *node) {
+    geo_push_scale(node);
     if (node->node.children != NULL) {
         geo_process_node_and_siblings(node->node.children);
     }
@@ -464,14 +529,10 @@ static void geo_process_scale(struct GraphNodeScale *node) {
 }
 
 /**
- * Process a billboard node. A transformation matrix is created that makes its
- * children face the camera, and it is pushed on the floating point and fixed
- * point matrix stacks.
- * For the rest it acts as a normal display list node.
+ * Push the transformation of a billboard node and append its display list.
  */
-static void geo_process_billboard(struct GraphNodeBillboard *node) {
+static void geo_push_billboard(struct GraphNodeBillboard *node) {
     Vec3f translation;
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
     gMatStackIndex++;
     vec3s_to_vec3f(translation, node->translation);
@@ -485,11 +546,20 @@ static void geo_process_billboard(struct GraphNodeBillboard *node) {
                          gCurGraphNodeObject->scale);
     }
 
-    mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = mtx;
+    geo_update_fixed_matrix();
     if (node->displayList != NULL) {
         geo_append_display_list(node->displayList, node->node.flags >> 8);
     }
+}
+
+/**
+ * Process a billboard node. A transformation matrix is created that makes its
+ * children face the camera, and it is pushed on the floating point and fixed
+ * point matrix stacks.
+ * For the rest it acts as a normal display list node.
+ */
+static void geo_process_billboard(struct GraphNodeBillboard *node) {
+    geo_push_billboard(node);
     if (node->node.children != NULL) {
         geo_process_node_and_siblings(node->node.children);
     }
@@ -511,10 +581,9 @@ static void geo_process_display_list(struct GraphNodeDisplayList *node) {
 }
 
 /**
- * Process a generated list. Instead of storing a pointer to a display list,
- * the list is generated on the fly by a function.
+ * Call the function of a generated list node and append the display list it returns.
  */
-static void geo_process_generated_list(struct GraphNodeGenerated *node) {
+static void geo_append_generated_list(struct GraphNodeGenerated *node) {
     if (node->fnNode.func != NULL) {
         Gfx *list = node->fnNode.func(GEO_CONTEXT_RENDER, &node->fnNode.node,
                                      (struct AllocOnlyPool *) gMatStack[gMatStackIndex]);
@@ -523,6 +592,14 @@ static void geo_process_generated_list(struct GraphNodeGenerated *node) {
             geo_append_display_list((void *) VIRTUAL_TO_PHYSICAL(list), node->fnNode.node.flags >> 8);
         }
     }
+}
+
+/**
+ * Process a generated list. Instead of storing a pointer to a display list,
+ * the list is generated on the fly by a function.
+ */
+static void geo_process_generated_list(struct GraphNodeGenerated *node) {
+    geo_append_generated_list(node);
     if (node->fnNode.node.children != NULL) {
         geo_process_node_and_siblings(node->fnNode.node.children);
     }
@@ -567,14 +644,53 @@ static void geo_process_background(struct GraphNodeBackground *node) {
 }
 
 /**
- * Render an animated part. The current animation state is not part of the node
- * but set in global variables. If an animated part is skipped, everything afterwards desyncs.
+ * libsm64: Same as geo_push_animated_part, but takes the translation and rotation matrix
+ * from the pre-decoded pose instead of the animation's index and value streams.
  */
-static void geo_process_animated_part(struct GraphNodeAnimatedPart *node) {
+static void geo_push_cached_animated_part(struct GraphNodeAnimatedPart *node) {
+    Mat4 matrix;
+    const struct AnimPose *pose = gCurAnimPose;
+    s32 i, j;
+
+    vec3f_set(matrix[3], node->translation[0], node->translation[1], node->translation[2]);
+    if (gCurAnimType == ANIM_TYPE_TRANSLATION || gCurAnimType == ANIM_TYPE_LATERAL_TRANSLATION) {
+        matrix[3][0] += pose->translation[0] * gCurAnimTranslationMultiplier;
+        matrix[3][2] += pose->translation[2] * gCurAnimTranslationMultiplier;
+    }
+    if (gCurAnimType == ANIM_TYPE_TRANSLATION || gCurAnimType == ANIM_TYPE_VERTICAL_TRANSLATION) {
+        matrix[3][1] += pose->translation[1] * gCurAnimTranslationMultiplier;
+    }
+    gCurAnimType = ANIM_TYPE_ROTATION;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            matrix[i][j] = gCurAnimPosePart < pose->numParts ? pose->rotations[gCurAnimPosePart][i][j] : (f32) (i == j);
+        }
+        matrix[i][3] = 0;
+    }
+    matrix[3][3] = 1;
+    gCurAnimPosePart++;
+
+    mtxf_mul(gMatStack[gMatStackIndex + 1], matrix, gMatStack[gMatStackIndex]);
+    gMatStackIndex++;
+    geo_update_fixed_matrix();
+    if (node->displayList != NULL) {
+        geo_append_display_list(node->displayList, node->node.flags >> 8);
+    }
+}
+
+/**
+ * Push the transformation of a animated part node and append its display list.
+ */
+static void geo_push_animated_part(struct GraphNodeAnimatedPart *node) {
     Mat4 matrix;
     Vec3s rotation;
     Vec3f translation;
-    Mtx *matrixPtr = alloc_display_list(sizeof(*matrixPtr));
+
+    if (gCurAnimPose != NULL && gCurAnimType != ANIM_TYPE_NONE) { // libsm64: pose cache
+        geo_push_cached_animated_part(node);
+        return;
+    }
 
     vec3s_copy(rotation, gVec3sZero);
     vec3f_set(translation, node->translation[0], node->translation[1], node->translation[2]);
@@ -619,11 +735,18 @@ static void geo_process_animated_part(struct GraphNodeAnimatedPart *node) {
     mtxf_rotate_xyz_and_translate(matrix, translation, rotation);
     mtxf_mul(gMatStack[gMatStackIndex + 1], matrix, gMatStack[gMatStackIndex]);
     gMatStackIndex++;
-    mtxf_to_mtx(matrixPtr, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = matrixPtr;
+    geo_update_fixed_matrix();
     if (node->displayList != NULL) {
         geo_append_display_list(node->displayList, node->node.flags >> 8);
     }
+}
+
+/**
+ * Render an animated part. The current animation state is not part of the node
+ * but set in global variables. If an animated part is skipped, everything afterwards desyncs.
+ */
+static void geo_process_animated_part(struct GraphNodeAnimatedPart *node) {
+    geo_push_animated_part(node);
     if (node->node.children != NULL) {
         geo_process_node_and_siblings(node->node.children);
     }
@@ -655,6 +778,8 @@ void geo_set_animation_globals(struct AnimInfo *node, s32 hasAnimation) {
     gCurAnimEnabled = (anim->flags & ANIM_FLAG_5) == 0;
     gCurrAnimAttribute = segmented_to_virtual((void *) anim->index);
     gCurAnimData = segmented_to_virtual((void *) anim->values);
+    gCurAnimPose = anim_pose_cache_get(anim, gCurrAnimFrame); // libsm64: pose cache
+    gCurAnimPosePart = 0;
 
     if (anim->animYTransDivisor == 0) {
         gCurAnimTranslationMultiplier = 1.0f;
@@ -861,10 +986,7 @@ static void geo_process_object(struct Object *node) {
             geo_set_animation_globals(&node->header.gfx.animInfo, hasAnimation);
         }
         if (obj_is_in_view(&node->header.gfx, gMatStack[gMatStackIndex])) {
-            Mtx *mtx = alloc_display_list(sizeof(*mtx));
-
-            mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-            gMatStackFixed[gMatStackIndex] = mtx;
+            geo_update_fixed_matrix();
             if (node->header.gfx.sharedChild != NULL) {
                 gCurGraphNodeObject = (struct GraphNodeObject *) node;
                 node->header.gfx.sharedChild->parent = &node->header.gfx.node;
@@ -905,7 +1027,6 @@ static void geo_process_object_parent(struct GraphNodeObjectParent *node) {
 void geo_process_held_object(struct GraphNodeHeldObject *node) {
     Mat4 mat;
     Vec3f translation;
-    Mtx *mtx = alloc_display_list(sizeof(*mtx));
 
 #ifdef F3DEX_GBI_2
     gSPLookAt(gDisplayListHead++, &lookAt);
@@ -934,14 +1055,15 @@ void geo_process_held_object(struct GraphNodeHeldObject *node) {
                               (struct AllocOnlyPool *) gMatStack[gMatStackIndex + 1]);
         }
         gMatStackIndex++;
-        mtxf_to_mtx(mtx, gMatStack[gMatStackIndex]);
-        gMatStackFixed[gMatStackIndex] = mtx;
+        geo_update_fixed_matrix();
         gGeoTempState.type = gCurAnimType;
         gGeoTempState.enabled = gCurAnimEnabled;
         gGeoTempState.frame = gCurrAnimFrame;
         gGeoTempState.translationMultiplier = gCurAnimTranslationMultiplier;
         gGeoTempState.attribute = gCurrAnimAttribute;
         gGeoTempState.data = gCurAnimData;
+        gGeoTempState.pose = gCurAnimPose;
+        gGeoTempState.posePart = gCurAnimPosePart;
         gCurAnimType = 0;
         gCurGraphNodeHeldObject = (void *) node;
         if (node->objNode->header.gfx.animInfo.curAnim != NULL) {
@@ -956,6 +1078,8 @@ void geo_process_held_object(struct GraphNodeHeldObject *node) {
         gCurAnimTranslationMultiplier = gGeoTempState.translationMultiplier;
         gCurrAnimAttribute = gGeoTempState.attribute;
         gCurAnimData = gGeoTempState.data;
+        gCurAnimPose = gGeoTempState.pose;
+        gCurAnimPosePart = gGeoTempState.posePart;
         gMatStackIndex--;
     }
 
@@ -973,6 +1097,76 @@ void geo_try_process_children(struct GraphNode *node) {
     }
 }
 
+/**
+ * Process a single active node by its type. Its children are processed by
+ * the node's own function.
+ */
+static void geo_process_node(struct GraphNode *curGraphNode) {
+    switch (curGraphNode->type) {
+        case GRAPH_NODE_TYPE_ORTHO_PROJECTION:
+            geo_process_ortho_projection((struct GraphNodeOrthoProjection *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_PERSPECTIVE:
+            geo_process_perspective((struct GraphNodePerspective *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_MASTER_LIST:
+            geo_process_master_list((struct GraphNodeMasterList *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_LEVEL_OF_DETAIL:
+            geo_process_level_of_detail((struct GraphNodeLevelOfDetail *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_SWITCH_CASE:
+            geo_process_switch((struct GraphNodeSwitchCase *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_CAMERA:
+            geo_process_camera((struct GraphNodeCamera *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_TRANSLATION_ROTATION:
+            geo_process_translation_rotation(
+                (struct GraphNodeTranslationRotation *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_TRANSLATION:
+            geo_process_translation((struct GraphNodeTranslation *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_ROTATION:
+            geo_process_rotation((struct GraphNodeRotation *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_OBJECT:
+            geo_process_object((struct Object *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_ANIMATED_PART:
+            geo_process_animated_part((struct GraphNodeAnimatedPart *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_BILLBOARD:
+            geo_process_billboard((struct GraphNodeBillboard *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_DISPLAY_LIST:
+            geo_process_display_list((struct GraphNodeDisplayList *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_SCALE:
+            geo_process_scale((struct GraphNodeScale *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_SHADOW:
+            geo_process_shadow((struct GraphNodeShadow *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_OBJECT_PARENT:
+            geo_process_object_parent((struct GraphNodeObjectParent *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_GENERATED_LIST:
+            geo_process_generated_list((struct GraphNodeGenerated *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_BACKGROUND:
+            geo_process_background((struct GraphNodeBackground *) curGraphNode);
+            break;
+        case GRAPH_NODE_TYPE_HELD_OBJ:
+            geo_process_held_object((struct GraphNodeHeldObject *) curGraphNode);
+            break;
+        default:
+            geo_try_process_children((struct GraphNode *) curGraphNode);
+            break;
+    }
+}
+
 /**
  * Process a generic geo node and its siblings.
  * The first argument is the start node, and all its siblings will
@@ -994,69 +1188,7 @@ void geo_process_node_and_siblings(struct GraphNode *firstNode) {
             if (curGraphNode->flags & GRAPH_RENDER_CHILDREN_FIRST) {
                 geo_try_process_children(curGraphNode);
             } else {
-                switch (curGraphNode->type) {
-                    case GRAPH_NODE_TYPE_ORTHO_PROJECTION:
-                        geo_process_ortho_projection((struct GraphNodeOrthoProjection *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_PERSPECTIVE:
-                        geo_process_perspective((struct GraphNodePerspective *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_MASTER_LIST:
-                        geo_process_master_list((struct GraphNodeMasterList *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_LEVEL_OF_DETAIL:
-                        geo_process_level_of_detail((struct GraphNodeLevelOfDetail *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_SWITCH_CASE:
-                        geo_process_switch((struct GraphNodeSwitchCase *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_CAMERA:
-                        geo_process_camera((struct GraphNodeCamera *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_TRANSLATION_ROTATION:
-                        geo_process_translation_rotation(
-                            (struct GraphNodeTranslationRotation *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_TRANSLATION:
-                        geo_process_translation((struct GraphNodeTranslation *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_ROTATION:
-                        geo_process_rotation((struct GraphNodeRotation *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_OBJECT:
-                        geo_process_object((struct Object *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_ANIMATED_PART:
-                        geo_process_animated_part((struct GraphNodeAnimatedPart *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_BILLBOARD:
-                        geo_process_billboard((struct GraphNodeBillboard *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_DISPLAY_LIST:
-                        geo_process_display_list((struct GraphNodeDisplayList *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_SCALE:
-                        geo_process_scale((struct GraphNodeScale *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_SHADOW:
-                        geo_process_shadow((struct GraphNodeShadow *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_OBJECT_PARENT:
-                        geo_process_object_parent((struct GraphNodeObjectParent *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_GENERATED_LIST:
-                        geo_process_generated_list((struct GraphNodeGenerated *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_BACKGROUND:
-                        geo_process_background((struct GraphNodeBackground *) curGraphNode);
-                        break;
-                    case GRAPH_NODE_TYPE_HELD_OBJ:
-                        geo_process_held_object((struct GraphNodeHeldObject *) curGraphNode);
-                        break;
-                    default:
-                        geo_try_process_children((struct GraphNode *) curGraphNode);
-                        break;
-                }
+                geo_process_node(curGraphNode);
             }
         } else {
             if (curGraphNode->type == GRAPH_NODE_TYPE_OBJECT) {
@@ -1066,6 +1198,302 @@ void geo_process_node_and_siblings(struct GraphNode *firstNode) {
     } while (iterateChildren && (curGraphNode = curGraphNode->next) != firstNode);
 }
 
+/**
+ * libsm64: Mario's graph doesn't change shape after process_geo_layout, so it's flattened once
+ * into an array of nodes in the order the recursive walk above visits them. Each entry knows its
+ * parent, its position among its siblings and where its subtree ends, which turns the walk into a
+ * loop over the array: skipping a subtree is a jump to its end, and nodes are closed off from a
+ * small stack once the loop passes the end of their subtree.
+ *
+ * What each node type does is split into sGeoFlatHandlers, with an enter function that runs
+ * before the children (and says whether to visit them) and a leave function that runs after.
+ * Nodes that render other graphs (objects, held objects, cameras, backgrounds...) aren't split,
+ * their whole subtree goes through the recursive walk.
+ */
+enum GeoFlatHandlerId {
+    GEO_FLAT_CHILDREN,
+    GEO_FLAT_RECURSIVE,
+    GEO_FLAT_MASTER_LIST,
+    GEO_FLAT_LEVEL_OF_DETAIL,
+    GEO_FLAT_SWITCH_CASE,
+    GEO_FLAT_TRANSLATION_ROTATION,
+    GEO_FLAT_TRANSLATION,
+    GEO_FLAT_ROTATION,
+    GEO_FLAT_ANIMATED_PART,
+    GEO_FLAT_BILLBOARD,
+    GEO_FLAT_DISPLAY_LIST,
+    GEO_FLAT_SCALE,
+    GEO_FLAT_SHADOW,
+    GEO_FLAT_GENERATED_LIST,
+};
+
+struct GeoFlatNode {
+    struct GraphNode *node;
+    u8 handler;
+    s16 parent; // -1 for the root's children
+    s16 end;    // index one past the last node of this subtree
+    s16 childIndex;
+    s16 numChildren;
+    s16 selectedChild; // Which child a switch case visits, set when it's entered
+};
+
+struct GeoFlatOpenNode {
+    s16 index;
+    s16 entered; // FALSE when only the children are processed (GRAPH_RENDER_CHILDREN_FIRST)
+};
+
+struct GeoFlatGraph {
+    struct GeoFlatNode *nodes;
+    s16 numNodes;
+    struct GeoFlatOpenNode *openNodes;
+};
+
+struct GeoFlatHandler {
+    s32 (*enter)(struct GeoFlatNode *flatNode);
+    void (*leave)(struct GeoFlatNode *flatNode);
+};
+
+static s32 geo_flat_enter_children(UNUSED struct GeoFlatNode *flatNode) {
+    return TRUE;
+}
+
+static s32 geo_flat_enter_recursive(struct GeoFlatNode *flatNode) {
+    geo_process_node(flatNode->node);
+    return FALSE;
+}
+
+static void geo_flat_leave_matrix(UNUSED struct GeoFlatNode *flatNode) {
+    gMatStackIndex--;
+}
+
+static s32 geo_flat_enter_master_list(struct GeoFlatNode *flatNode) {
+    return geo_enter_master_list((struct GraphNodeMasterList *) flatNode->node);
+}
+
+static void geo_flat_leave_master_list(struct GeoFlatNode *flatNode) {
+    geo_process_master_list_sub((struct GraphNodeMasterList *) flatNode->node);
+    gCurGraphNodeMasterList = NULL;
+}
+
+static s32 geo_flat_enter_level_of_detail(struct GeoFlatNode *flatNode) {
+    return geo_level_of_detail_in_range((struct GraphNodeLevelOfDetail *) flatNode->node);
+}
+
+static s32 geo_flat_enter_switch_case(struct GeoFlatNode *flatNode) {
+    struct GraphNodeSwitchCase *node = (struct GraphNodeSwitchCase *) flatNode->node;
+
+    if (node->fnNode.func != NULL) {
+        node->fnNode.func(GEO_CONTEXT_RENDER, &node->fnNode.node, gMatStack[gMatStackIndex]);
+    }
+    // The children are a circular list, so geo_process_switch wraps around past the last one
+    flatNode->selectedChild = (node->selectedCase > 0 && flatNode->numChildren > 0)
+                                ? node->selectedCase % flatNode->numChildren : 0;
+    return TRUE;
+}
+
+static s32 geo_flat_enter_translation_rotation(struct GeoFlatNode *flatNode) {
+    geo_push_translation_rotation((struct GraphNodeTranslationRotation *) flatNode->node);
+    return TRUE;
+}
+
+static s32 geo_flat_enter_translation(struct GeoFlatNode *flatNode) {
+    geo_push_translation((struct GraphNodeTranslation *) flatNode->node);
+    return TRUE;
+}
+
+static s32 geo_flat_enter_rotation(struct GeoFlatNode *flatNode) {
+    geo_push_rotation((struct GraphNodeRotation *) flatNode->node);
+    return TRUE;
+}
+
+static s32 geo_flat_enter_animated_part(struct GeoFlatNode *flatNode) {
+    geo_push_animated_part((struct GraphNodeAnimatedPart *) flatNode->node);
+    return TRUE;
+}
+
+static s32 geo_flat_enter_billboard(struct GeoFlatNode *flatNode) {
+    geo_push_billboard((struct GraphNodeBillboard *) flatNode->node);
+    return TRUE;
+}
+
+static s32 geo_flat_enter_display_list(struct GeoFlatNode *flatNode) {
+    struct GraphNodeDisplayList *node = (struct GraphNodeDisplayList *) flatNode->node;
+
+    if (node->displayList != NULL) {
+        geo_append_display_list(node->displayList, node->node.flags >> 8);
+    }
+    return TRUE;
+}
+
+static s32 geo_flat_enter_scale(struct GeoFlatNode *flatNode) {
+    geo_push_scale((struct GraphNodeScale *) flatNode->node);
+    return TRUE;
+}
+
+static s32 geo_flat_enter_shadow(UNUSED struct GeoFlatNode *flatNode) {
+    return FALSE; // geo_process_shadow is stubbed out, including its children
+}
+
+static s32 geo_flat_enter_generated_list(struct GeoFlatNode *flatNode) {
+    geo_append_generated_list((struct GraphNodeGenerated *) flatNode->node);
+    return TRUE;
+}
+
+static const struct GeoFlatHandler sGeoFlatHandlers[] = {
+    [GEO_FLAT_CHILDREN]             = { geo_flat_enter_children, NULL },
+    [GEO_FLAT_RECURSIVE]            = { geo_flat_enter_recursive, NULL },
+    [GEO_FLAT_MASTER_LIST]          = { geo_flat_enter_master_list, geo_flat_leave_master_list },
+    [GEO_FLAT_LEVEL_OF_DETAIL]      = { geo_flat_enter_level_of_detail, NULL },
+    [GEO_FLAT_SWITCH_CASE]          = { geo_flat_enter_switch_case, NULL },
+    [GEO_FLAT_TRANSLATION_ROTATION] = { geo_flat_enter_translation_rotation, geo_flat_leave_matrix },
+    [GEO_FLAT_TRANSLATION]          = { geo_flat_enter_translation, geo_flat_leave_matrix },
+    [GEO_FLAT_ROTATION]             = { geo_flat_enter_rotation, geo_flat_leave_matrix },
+    [GEO_FLAT_ANIMATED_PART]        = { geo_flat_enter_animated_part, geo_flat_leave_matrix },
+    [GEO_FLAT_BILLBOARD]            = { geo_flat_enter_billboard, geo_flat_leave_matrix },
+    [GEO_FLAT_DISPLAY_LIST]         = { geo_flat_enter_display_list, NULL },
+    [GEO_FLAT_SCALE]                = { geo_flat_enter_scale, geo_flat_leave_matrix },
+    [GEO_FLAT_SHADOW]               = { geo_flat_enter_shadow, NULL },
+    [GEO_FLAT_GENERATED_LIST]       = { geo_flat_enter_generated_list, NULL },
+};
+
+static u8 geo_flat_handler_for_type(s16 type) {
+    switch (type) {
+        case GRAPH_NODE_TYPE_MASTER_LIST:          return GEO_FLAT_MASTER_LIST;
+        case GRAPH_NODE_TYPE_LEVEL_OF_DETAIL:      return GEO_FLAT_LEVEL_OF_DETAIL;
+        case GRAPH_NODE_TYPE_SWITCH_CASE:          return GEO_FLAT_SWITCH_CASE;
+        case GRAPH_NODE_TYPE_TRANSLATION_ROTATION: return GEO_FLAT_TRANSLATION_ROTATION;
+        case GRAPH_NODE_TYPE_TRANSLATION:          return GEO_FLAT_TRANSLATION;
+        case GRAPH_NODE_TYPE_ROTATION:             return GEO_FLAT_ROTATION;
+        case GRAPH_NODE_TYPE_ANIMATED_PART:        return GEO_FLAT_ANIMATED_PART;
+        case GRAPH_NODE_TYPE_BILLBOARD:            return GEO_FLAT_BILLBOARD;
+        case GRAPH_NODE_TYPE_DISPLAY_LIST:         return GEO_FLAT_DISPLAY_LIST;
+        case GRAPH_NODE_TYPE_SCALE:                return GEO_FLAT_SCALE;
+        case GRAPH_NODE_TYPE_SHADOW:               return GEO_FLAT_SHADOW;
+        case GRAPH_NODE_TYPE_GENERATED_LIST:       return GEO_FLAT_GENERATED_LIST;
+        case GRAPH_NODE_TYPE_ORTHO_PROJECTION:
+        case GRAPH_NODE_TYPE_PERSPECTIVE:
+        case GRAPH_NODE_TYPE_CAMERA:
+        case GRAPH_NODE_TYPE_OBJECT:
+        case GRAPH_NODE_TYPE_OBJECT_PARENT:
+        case GRAPH_NODE_TYPE_BACKGROUND:
+        case GRAPH_NODE_TYPE_HELD_OBJ:             return GEO_FLAT_RECURSIVE;
+        default:                                   return GEO_FLAT_CHILDREN;
+    }
+}
+
+static s16 geo_count_nodes(struct GraphNode *firstNode) {
+    struct GraphNode *node = firstNode;
+    s16 count = 0;
+
+    do {
+        count++;
+        if (node->children != NULL) {
+            count += geo_count_nodes(node->children);
+        }
+    } while ((node = node->next) != firstNode);
+
+    return count;
+}
+
+static void geo_flatten_node_and_siblings(struct GeoFlatGraph *graph, struct GraphNode *firstNode, s16 parent) {
+    struct GraphNode *node = firstNode;
+    s16 childIndex = 0;
+
+    do {
+        s16 index = graph->numNodes++;
+        struct GeoFlatNode *flatNode = &graph->nodes[index];
+
+        flatNode->node = node;
+        flatNode->handler = geo_flat_handler_for_type(node->type);
+        flatNode->parent = parent;
+        flatNode->childIndex = childIndex++;
+        flatNode->numChildren = 0;
+        flatNode->selectedChild = 0;
+        if (parent >= 0) {
+            graph->nodes[parent].numChildren++;
+        }
+
+        if (node->children != NULL) {
+            geo_flatten_node_and_siblings(graph, node->children, index);
+        }
+        graph->nodes[index].end = graph->numNodes;
+    } while ((node = node->next) != firstNode);
+}
+
+/**
+ * Flatten the children of a graph root for geo_process_root_hack_single_node.
+ */
+struct GeoFlatGraph *geo_flatten_graph(struct GraphNode *root) {
+    struct GeoFlatGraph *graph = malloc(sizeof(struct GeoFlatGraph));
+    s16 count = root->children != NULL ? geo_count_nodes(root->children) : 0;
+
+    graph->nodes = malloc(count * sizeof(struct GeoFlatNode));
+    graph->openNodes = malloc(count * sizeof(struct GeoFlatOpenNode));
+    graph->numNodes = 0;
+    if (root->children != NULL) {
+        geo_flatten_node_and_siblings(graph, root->children, -1);
+    }
+    return graph;
+}
+
+void geo_free_flat_graph(struct GeoFlatGraph *graph) {
+    free(graph->nodes);
+    free(graph->openNodes);
+    free(graph);
+}
+
+static void geo_process_flat_graph(struct GeoFlatGraph *graph) {
+    struct GeoFlatNode *nodes = graph->nodes;
+    struct GeoFlatOpenNode *openNodes = graph->openNodes;
+    s16 numOpen = 0;
+    s16 i = 0;
+
+    for (;;) {
+        while (numOpen > 0 && nodes[openNodes[numOpen - 1].index].end <= i) {
+            struct GeoFlatOpenNode *open = &openNodes[--numOpen];
+            struct GeoFlatNode *openNode = &nodes[open->index];
+
+            if (open->entered && sGeoFlatHandlers[openNode->handler].leave != NULL) {
+                sGeoFlatHandlers[openNode->handler].leave(openNode);
+            }
+        }
+        if (i >= graph->numNodes) {
+            break;
+        }
+
+        struct GeoFlatNode *flatNode = &nodes[i];
+        struct GraphNode *node = flatNode->node;
+
+        // Children of a switch case node other than the selected one are skipped
+        if (flatNode->parent >= 0 && nodes[flatNode->parent].node->type == GRAPH_NODE_TYPE_SWITCH_CASE
+            && flatNode->childIndex != nodes[flatNode->parent].selectedChild) {
+            i = flatNode->end;
+            continue;
+        }
+
+        if (!(node->flags & GRAPH_RENDER_ACTIVE)) {
+            if (node->type == GRAPH_NODE_TYPE_OBJECT) {
+                ((struct GraphNodeObject *) node)->throwMatrix = NULL;
+            }
+            i = flatNode->end;
+            continue;
+        }
+
+        if (node->flags & GRAPH_RENDER_CHILDREN_FIRST) {
+            flatNode->selectedChild = 0;
+            openNodes[numOpen].index = i;
+            openNodes[numOpen++].entered = FALSE;
+        } else if (sGeoFlatHandlers[flatNode->handler].enter(flatNode)) {
+            openNodes[numOpen].index = i;
+            openNodes[numOpen++].entered = TRUE;
+        } else {
+            i = flatNode->end;
+            continue;
+        }
+        i++;
+    }
+}
+
 /**
  * Process a root node. This is the entry point for processing the scene graph.
  * The root node itself sets up the viewport, then all its children are processed
@@ -1121,29 +1549,35 @@ void geo_process_node_and_siblings(struct GraphNode *firstNode) {
 //     }
 // }
 
-void geo_process_root_hack_single_node(struct GraphNode *node)
+void geo_process_root_hack_single_node(struct GraphNode *node, struct GeoFlatGraph *flatGraph)
 {
     gDisplayListHead = NULL; // Currently unused, but referenced
 
+    // libsm64: the list nodes share the display list arena, which is rewound here every tick
     display_list_pool_reset();
+    gDisplayListHeap = display_list_pool();
 
-    Mtx *initialMatrix;
-
-    gDisplayListHeap = alloc_only_pool_init();
-    initialMatrix = alloc_display_list(sizeof(*initialMatrix));
     gMatStackIndex = 0;
     gCurAnimType = 0;
 
     mtxf_identity(gMatStack[gMatStackIndex]);
-    mtxf_to_mtx(initialMatrix, gMatStack[gMatStackIndex]);
-    gMatStackFixed[gMatStackIndex] = initialMatrix;
+    geo_update_fixed_matrix();
+#ifdef GBI_FLOATS
+    gSPMatrixF(gDisplayListHead++, &gMatStack[gMatStackIndex]);
+#else
     gSPMatrix(gDisplayListHead++, VIRTUAL_TO_PHYSICAL(gMatStackFixed[gMatStackIndex]),
                 G_MTX_MODELVIEW | G_MTX_LOAD | G_MTX_NOPUSH);
+#endif
 
     // Hacked in from geo_proces_object since we only have Mario
     //geo_process_object( node );
+    // libsm64: with local space output the root transform goes to the host and only the scale stays on the stack
     if (gMarioObject->header.gfx.throwMatrix != NULL) {
-        mtxf_mul(gMatStack[gMatStackIndex + 1], *gMarioObject->header.gfx.throwMatrix, gMatStack[gMatStackIndex]);
+        if (gfx_adapter_set_root_transform(*gMarioObject->header.gfx.throwMatrix)) {
+            mtxf_copy(gMatStack[gMatStackIndex + 1], gMatStack[gMatStackIndex]);
+        } else {
+            mtxf_mul(gMatStack[gMatStackIndex + 1], *gMarioObject->header.gfx.throwMatrix, gMatStack[gMatStackIndex]);
+        }
         mtxf_scale_vec3f( gMatStack[gMatStackIndex + 1], gMatStack[gMatStackIndex + 1], gMarioObject->header.gfx.scale );
         gMarioObject->header.gfx.throwMatrix = &gMatStack[++gMatStackIndex];
     }
@@ -1152,17 +1586,21 @@ void geo_process_root_hack_single_node(struct GraphNode *node)
         mtxf_identity( identity );
         mtxf_scale_vec3f( scale, identity, gMarioObject->header.gfx.scale );
         mtxf_rotate_zxy_and_translate( rotTran, gMarioObject->header.gfx.pos, gMarioObject->header.gfx.angle );
-        mtxf_mul( gMatStack[++gMatStackIndex], scale, rotTran );
+        if (gfx_adapter_set_root_transform(rotTran)) {
+            mtxf_copy(gMatStack[++gMatStackIndex], scale);
+        } else {
+            mtxf_mul( gMatStack[++gMatStackIndex], scale, rotTran );
+        }
     }
     geo_set_animation_globals(&gMarioObject->header.gfx.animInfo, 1);
 
     gCurGraphNodeRoot = (struct GraphNodeRoot *)node;
-    if (node->children != NULL) {
+    if (flatGraph != NULL) {
+        geo_process_flat_graph(flatGraph);
+    } else if (node->children != NULL) {
         geo_process_node_and_siblings(node->children);
     }
     gCurGraphNodeRoot = NULL;
 
     gMarioObject->header.gfx.throwMatrix = NULL;
-
-    alloc_only_pool_free(gDisplayListHeap);
 }
\ No newline at end of file
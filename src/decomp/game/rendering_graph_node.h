@@ -5,6 +5,8 @@
 
 #include "../engine/graph_node.h"
 
+struct GeoFlatGraph;
+
 extern struct GraphNodeRoot *gCurGraphNodeRoot;
 extern struct GraphNodeMasterList *gCurGraphNodeMasterList;
 extern struct GraphNodePerspective *gCurGraphNodeCamFrustum;
@@ -28,6 +30,9 @@ extern struct GraphNodeHeldObject *gCurGraphNodeHeldObject;
 
 void geo_process_node_and_siblings(struct GraphNode *firstNode);
 //void geo_process_root(struct GraphNodeRoot *node, Vp *b, Vp *c, s32 clearColor);
-void geo_process_root_hack_single_node(struct GraphNode *node);
+void geo_process_root_hack_single_node(struct GraphNode *node, struct GeoFlatGraph *flatGraph);
+
+struct GeoFlatGraph *geo_flatten_graph(struct GraphNode *root);
+void geo_free_flat_graph(struct GeoFlatGraph *graph);
 
 #endif // RENDERING_GRAPH_NODE_H
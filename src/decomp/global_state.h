@@ -49,6 +49,5 @@ struct GlobalState
 
 extern struct GlobalState *g_state;
 
-extern struct GlobalState *global_state_create(void);
-extern void global_state_bind(struct GlobalState *state);
-extern void global_state_delete(struct GlobalState *state);
\ No newline at end of file
+extern void global_state_init(struct GlobalState *state);
+extern void global_state_bind(struct GlobalState *state);
\ No newline at end of file
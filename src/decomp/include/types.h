@@ -94,6 +94,7 @@ struct Animation {
     /*0x0C*/ s16 *values;
     /*0x10*/ u16 *index;
     /*0x14*/ u32 length; // only used with Mario animations to determine how much to load. 0 otherwise.
+    u32 indexLength; // libsm64: added field, number of u16s in index
 };
 
 #define ANIMINDEX_NUMPARTS(animindex) (sizeof(animindex) / sizeof(u16) / 6 - 1)
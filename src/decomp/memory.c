@@ -1,59 +1,158 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "memory.h"
 
-// TODO don't handle every individual allocation with malloc, it sucks on windows
+#define ARENA_ALIGNMENT 16
+#define ARENA_MIN_CHUNK_SIZE 0x4000
+#define ARENA_ALIGN(x) (((x) + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1))
 
-struct AllocOnlyPool 
+/**
+ * Pools are chunked bump arenas: an allocation takes the next aligned bytes of the current chunk
+ * and only goes to the heap when that chunk is full. Nothing is freed individually, a pool is
+ * either freed as a whole or rewound with alloc_only_pool_reset, which keeps its memory around.
+ * If the pool had to spill into more chunks since the last rewind, they get merged into a single
+ * chunk sized for the peak usage, so a pool that's rewound every tick stops touching the heap
+ * once it has seen its biggest tick.
+ */
+struct ArenaChunk
 {
-    size_t allocatedCount;
-    void **allocatedBlocks;
+    struct ArenaChunk *next;
+    u8 *data;
+    size_t size;
+    size_t used;
 };
 
-struct AllocOnlyPool *s_display_list_pool;
+struct AllocOnlyPool
+{
+    struct ArenaChunk *first;
+    struct ArenaChunk *current;
+    size_t usedSpace;
+    size_t peakSpace;
+};
+
+static struct AllocOnlyPool *s_display_list_pool;
+static size_t s_display_list_pool_peak; // Survives memory_terminate so the next init can preallocate it
+
+static struct ArenaChunk *arena_chunk_alloc( size_t size )
+{
+    struct ArenaChunk *chunk = malloc( sizeof( struct ArenaChunk ) + size + ARENA_ALIGNMENT );
+    chunk->next = NULL;
+    chunk->data = (u8 *)ARENA_ALIGN( (uintptr_t)( chunk + 1 ));
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void arena_free_chunks( struct AllocOnlyPool *pool )
+{
+    struct ArenaChunk *chunk = pool->first;
+    while( chunk != NULL )
+    {
+        struct ArenaChunk *next = chunk->next;
+        free( chunk );
+        chunk = next;
+    }
+    pool->first = pool->current = NULL;
+}
 
 void memory_init(void)
 {
-    s_display_list_pool = alloc_only_pool_init();
+    s_display_list_pool = alloc_only_pool_init_with_size( s_display_list_pool_peak );
 }
 
 void memory_terminate(void)
 {
+    s_display_list_pool_peak = alloc_only_pool_peak_size( s_display_list_pool );
     alloc_only_pool_free( s_display_list_pool );
+    s_display_list_pool = NULL;
 }
 
 struct AllocOnlyPool *alloc_only_pool_init(void)
+{
+    return alloc_only_pool_init_with_size( 0 );
+}
+
+struct AllocOnlyPool *alloc_only_pool_init_with_size(size_t initialSize)
 {
     struct AllocOnlyPool *newPool = malloc( sizeof( struct AllocOnlyPool ));
-    newPool->allocatedCount = 0;
-    newPool->allocatedBlocks = NULL;
+    newPool->first = NULL;
+    newPool->current = NULL;
+    newPool->usedSpace = 0;
+    newPool->peakSpace = 0;
+
+    if( initialSize > 0 )
+        newPool->first = newPool->current = arena_chunk_alloc( ARENA_ALIGN( initialSize ));
+
     return newPool;
 }
 
 void *alloc_only_pool_alloc(struct AllocOnlyPool *pool, s32 size)
 {
-    pool->allocatedCount++;
-    pool->allocatedBlocks = realloc( pool->allocatedBlocks, pool->allocatedCount * sizeof( void * ));
-    pool->allocatedBlocks[ pool->allocatedCount - 1 ] = malloc( size );
-    return pool->allocatedBlocks[ pool->allocatedCount - 1 ];
+    size_t alignedSize = ARENA_ALIGN( (size_t)size );
+    struct ArenaChunk *chunk = pool->current;
+
+    if( chunk == NULL || chunk->used + alignedSize > chunk->size )
+    {
+        size_t chunkSize = chunk != NULL ? 2 * chunk->size : ARENA_MIN_CHUNK_SIZE;
+        if( chunkSize < alignedSize )
+            chunkSize = alignedSize;
+
+        struct ArenaChunk *newChunk = arena_chunk_alloc( chunkSize );
+        if( chunk != NULL )
+            chunk->next = newChunk;
+        else
+            pool->first = newChunk;
+        pool->current = chunk = newChunk;
+    }
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += alignedSize;
+
+    pool->usedSpace += alignedSize;
+    if( pool->usedSpace > pool->peakSpace )
+        pool->peakSpace = pool->usedSpace;
+
+    return ptr;
+}
+
+void alloc_only_pool_reset(struct AllocOnlyPool *pool)
+{
+    if( pool->first != pool->current )
+    {
+        arena_free_chunks( pool );
+        pool->first = pool->current = arena_chunk_alloc( pool->peakSpace );
+    }
+
+    if( pool->first != NULL )
+        pool->first->used = 0;
+
+    pool->usedSpace = 0;
+}
+
+size_t alloc_only_pool_peak_size(struct AllocOnlyPool *pool)
+{
+    return pool->peakSpace;
 }
 
 void alloc_only_pool_free(struct AllocOnlyPool *pool)
 {
-    for( int i = 0; i < pool->allocatedCount; ++i )
-        free( pool->allocatedBlocks[i] );
-    free( pool->allocatedBlocks );
+    arena_free_chunks( pool );
     free( pool );
 }
 
+struct AllocOnlyPool *display_list_pool(void)
+{
+    return s_display_list_pool;
+}
+
 void display_list_pool_reset(void)
 {
-    alloc_only_pool_free( s_display_list_pool );
-    s_display_list_pool = alloc_only_pool_init();
+    alloc_only_pool_reset( s_display_list_pool );
 }
 
 void *alloc_display_list(u32 size)
 {
     return alloc_only_pool_alloc( s_display_list_pool, (s32)size );
-}
\ No newline at end of file
+}
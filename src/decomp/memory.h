@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "include/types.h"
 
 struct AllocOnlyPool;
@@ -8,8 +10,12 @@ extern void memory_init(void);
 extern void memory_terminate(void);
 
 extern struct AllocOnlyPool *alloc_only_pool_init(void);
+extern struct AllocOnlyPool *alloc_only_pool_init_with_size(size_t initialSize);
 extern void *alloc_only_pool_alloc(struct AllocOnlyPool *pool, s32 size);
+extern void alloc_only_pool_reset(struct AllocOnlyPool *pool);
+extern size_t alloc_only_pool_peak_size(struct AllocOnlyPool *pool);
 extern void alloc_only_pool_free(struct AllocOnlyPool *pool);
 
+extern struct AllocOnlyPool *display_list_pool(void);
 extern void display_list_pool_reset(void);
-extern void *alloc_display_list(u32 size);
\ No newline at end of file
+extern void *alloc_display_list(u32 size);
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #if defined(_WIN32) || defined(_WIN64)
 #include <io.h>
 #include <fcntl.h>
@@ -193,6 +194,86 @@ int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end)
    return bytes_written;
 }
 
+// copy 8 bytes, src may overlap dst as long as it's at least 8 bytes behind it
+static inline void copy8(unsigned char *dst, const unsigned char *src)
+{
+   uint64_t v;
+   memcpy(&v, src, 8);
+   memcpy(dst, &v, 8);
+}
+
+// a back-reference is at most 18 bytes, copied as 3 x 8 bytes while there's room for that
+#define MIO0_FAST_SLACK 24
+
+int mio0_decode_fast(const unsigned char *in, unsigned char *out, unsigned int *end)
+{
+   mio0_header_t head;
+
+   if (!mio0_decode_header(in, &head)) {
+      return -2;
+   }
+
+   const unsigned char *ctrl = &in[MIO0_HEADER_LENGTH];
+   const unsigned char *comp = &in[head.comp_offset];
+   const unsigned char *uncomp = &in[head.uncomp_offset];
+   unsigned char *dst = out;
+   unsigned char *dst_end = out + head.dest_size;
+   unsigned char *dst_fast_end = head.dest_size > MIO0_FAST_SLACK ? dst_end - MIO0_FAST_SLACK : out;
+
+   while (dst < dst_end) {
+      // control bits are consumed 32 at a time from the top, shifting in zeros
+      uint32_t bits = (uint32_t)ctrl[0] << 24 | (uint32_t)ctrl[1] << 16 | (uint32_t)ctrl[2] << 8 | ctrl[3];
+      int remaining = 32;
+      ctrl += 4;
+
+      while (remaining > 0 && dst < dst_end) {
+         if (bits & 0x80000000) {
+            // 1 - a run of uncompressed bytes, as long as the run of set bits
+            uint32_t inv = ~bits;
+            int run = inv ? __builtin_clz(inv) : 32;
+            if (run > dst_end - dst) {
+               run = (int)(dst_end - dst);
+            }
+            memcpy(dst, uncomp, run);
+            dst += run;
+            uncomp += run;
+            bits = run < 32 ? bits << run : 0;
+            remaining -= run;
+         } else {
+            // 0 - back-reference
+            int length = (comp[0] >> 4) + 3;
+            int idx = ((comp[0] & 0x0F) << 8) + comp[1] + 1;
+            const unsigned char *src = dst - idx;
+            comp += 2;
+
+            if (idx >= 8 && dst < dst_fast_end) {
+               copy8(dst, src);
+               copy8(dst + 8, src + 8);
+               copy8(dst + 16, src + 16);
+            } else if (idx == 1 && length <= dst_end - dst) {
+               memset(dst, src[0], length);
+            } else {
+               if (length > dst_end - dst) {
+                  length = (int)(dst_end - dst);
+               }
+               for (int i = 0; i < length; i++) {
+                  dst[i] = src[i];
+               }
+            }
+            dst += length;
+            bits <<= 1;
+            remaining--;
+         }
+      }
+   }
+
+   if (end) {
+      *end = head.uncomp_offset + (unsigned int)(uncomp - &in[head.uncomp_offset]);
+   }
+
+   return (int)(dst - out);
+}
+
 int mio0_encode(const unsigned char *in, unsigned int length, unsigned char *out)
 {
    unsigned char *bit_buf;
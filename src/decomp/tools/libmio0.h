@@ -30,6 +30,10 @@ void mio0_encode_header(unsigned char *buf, const mio0_header_t *head);
 // returns bytes extracted to 'out' or negative value on failure
 int mio0_decode(const unsigned char *in, unsigned char *out, unsigned int *end);
 
+// same as mio0_decode, but takes control bits 32 at a time, copies runs of uncompressed bytes
+// with memcpy and back-references 8 bytes at a time. mio0_decode stays as the reference.
+int mio0_decode_fast(const unsigned char *in, unsigned char *out, unsigned int *end);
+
 // encode MIO0 data in memory
 // in: buffer containing raw data
 // out: buffer for MIO0 data
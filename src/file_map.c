@@ -0,0 +1,80 @@
+#include "file_map.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+bool file_map_open( struct FileMap *map, const char *path )
+{
+    memset( map, 0, sizeof( struct FileMap ));
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+    if( file == INVALID_HANDLE_VALUE )
+        return false;
+
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 ||
+        !( mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL )))
+    {
+        CloseHandle( file );
+        return false;
+    }
+
+    map->file = file;
+    map->mapping = mapping;
+    map->data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+    map->size = (size_t)size.QuadPart;
+#else
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 )
+        return false;
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+    {
+        close( fd );
+        return false;
+    }
+
+    // The file can be closed as soon as it's mapped, the mapping keeps it alive
+    void *data = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+
+    map->data = data == MAP_FAILED ? NULL : data;
+    map->size = (size_t)st.st_size;
+#endif
+
+    if( map->data == NULL )
+    {
+        file_map_close( map );
+        return false;
+    }
+
+    return true;
+}
+
+void file_map_close( struct FileMap *map )
+{
+#ifdef _WIN32
+    if( map->data )
+        UnmapViewOfFile( map->data );
+    if( map->mapping )
+        CloseHandle( map->mapping );
+    if( map->file )
+        CloseHandle( map->file );
+#else
+    if( map->data )
+        munmap( (void *)map->data, map->size );
+#endif
+
+    memset( map, 0, sizeof( struct FileMap ));
+}
\ No newline at end of file
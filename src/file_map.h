@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// A whole file mapped read-only into memory
+struct FileMap
+{
+    const uint8_t *data;
+    size_t size;
+    void *file;
+    void *mapping;
+};
+
+extern bool file_map_open( struct FileMap *map, const char *path );
+extern void file_map_close( struct FileMap *map );
\ No newline at end of file
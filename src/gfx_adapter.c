@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -6,9 +7,70 @@
 #include "decomp/engine/guMtxF2L.h"
 #include "gfx_adapter.h"
 #include "gfx_adapter_commands.h"
+#include "gfx_kernels.h"
 #include "load_tex_data.h"
-
-static Mat4 s_curMatrix;
+#include "debug_print.h"
+
+#define MAX_VERTEX_SLOTS 32
+#define MAX_DRAWN_LISTS 128
+#define LIST_HASH_INITIAL_SIZE 256 // power of two
+#define POSE_MEMO_ENTRIES 32
+
+/**
+ * Mario's display lists are compiled once, by gfx_adapter_compile_graph at sm64_global_init,
+ * into flat tables of decoded float positions, normals, colours and atlas UVs. Each compiled
+ * list is one matrix slot: all of its vertices are drawn with the matrix from the gSPMatrix
+ * before it. Vertices shared between triangles are stored once and the triangles are kept as
+ * indices relative to the list's first vertex, so a tick only has to run the transform over
+ * contiguous arrays with the batch kernels from gfx_kernels.c.
+ *
+ * Mario's topology only changes when different display lists get drawn (cap/hand/eye states).
+ * The sequence of lists drawn in a tick is interned into a topology id which is stored in the
+ * output buffers, so SM64_GEO_FLAG_INDEXED only writes the index buffer and
+ * SM64_GEO_FLAG_STATIC_ATTRIBUTES only writes colours and UVs when that sequence changes.
+ */
+struct CompiledDisplayList
+{
+    void *displayList;
+    uint32_t firstVertex;
+    uint32_t firstIndex;
+    uint16_t numVertices;
+    uint16_t numIndices;
+};
+
+struct Topology
+{
+    uint32_t id;
+    uint32_t indexed;
+    uint32_t numLists;
+    uint16_t *lists;
+};
+
+/**
+ * With SM64_GEO_FLAG_LOCAL_SPACE the root transform is left to the host, so the output only
+ * depends on which lists were drawn and with which local matrices. Draws are recorded during the
+ * traversal and transformed at the end, unless a Mario in the same pose (a crowd playing the same
+ * animation frame) already produced that output, in which case it's copied from here.
+ */
+struct PoseMemoEntry
+{
+    uint32_t hash;
+    uint32_t indexed;
+    uint32_t numLists;
+    uint16_t lists[MAX_DRAWN_LISTS];
+    Mat4 matrices[MAX_DRAWN_LISTS];
+    uint16_t numTriangles;
+    uint16_t numVertices;
+    uint32_t numFloats;
+    uint32_t maxFloats;
+    float *positions;
+    float *normals;
+};
+
+static Mat4 s_loadedMatrix;
+static Mat4 *s_curMatrix = &s_loadedMatrix;
+static Mat4 s_curNormalMatrix;
+static bool s_curNormalMatrixIsRotation;
 static float s_curColor[3];
 
 static uint16_t s_scaleS, s_scaleT, s_uls, s_ult;
@@ -19,16 +81,39 @@ static float s_texHeight;
 static struct SM64MarioGeometryBuffers *s_outBuffers;
 
 static float *s_trianglePtr;
-static float *s_colorPtr;
 static float *s_normalPtr;
-static float *s_uvPtr;
 
-static void mtxf_mul_vec3f_x(Mat4 mtx, Vec3f b, float w, Vec3f out)
-{
-    out[0] = b[0] * mtx[0][0] + b[1] * mtx[1][0] + b[2] * mtx[2][0] + w * mtx[3][0];
-    out[1] = b[0] * mtx[0][1] + b[1] * mtx[1][1] + b[2] * mtx[2][1] + w * mtx[3][1];
-    out[2] = b[0] * mtx[0][2] + b[1] * mtx[1][2] + b[2] * mtx[2][2] + w * mtx[3][2];
-}
+static struct CompiledDisplayList *s_lists;
+static uint32_t s_numLists;
+static uint16_t *s_listHash; // index + 1 into s_lists, 0 is empty
+static uint32_t s_listHashSize;
+
+static float *s_positions;
+static float *s_normals;
+static float *s_colors;
+static float *s_uvs;
+static uint32_t s_numVertices, s_maxVertices;
+static uint16_t *s_indices;
+static uint32_t s_numIndices, s_maxIndices;
+
+static float *s_scratchPositions;
+static float *s_scratchNormals;
+static uint32_t s_maxScratchVertices;
+
+static struct Topology *s_topologies;
+static uint32_t s_numTopologies;
+static uint32_t s_nextTopologyId = 1; // Not reset on terminate, output buffers may outlive it
+
+static uint16_t s_drawnLists[MAX_DRAWN_LISTS];
+static uint32_t s_numDrawnLists;
+static Mat4 s_drawnMatrices[MAX_DRAWN_LISTS];
+
+static struct PoseMemoEntry *s_poseMemo;
+static uint32_t s_nextPoseMemo;
+
+static struct CompiledDisplayList *s_buildList;
+static int16_t s_vertexSlots[MAX_VERTEX_SLOTS];
+static intptr_t s_numVertexSlots;
 
 static void convert_uv_to_atlas( float *atlas_uv_out, short tc[] )
 {
@@ -39,6 +124,78 @@ static void convert_uv_to_atlas( float *atlas_uv_out, short tc[] )
     atlas_uv_out[1] = v * s_texHeight / 64.0f;
 }
 
+static void invalidate_vertex_slots( void )
+{
+    memset( s_vertexSlots, 0xFF, sizeof( s_vertexSlots ));
+}
+
+static uint16_t add_compiled_vertex( Vtx *vdata, intptr_t slot )
+{
+    struct CompiledDisplayList *list = s_buildList;
+    bool cached = slot < s_numVertexSlots && slot < MAX_VERTEX_SLOTS;
+
+    if( cached && s_vertexSlots[slot] >= 0 )
+        return (uint16_t)s_vertexSlots[slot];
+
+    if( s_numVertices == s_maxVertices )
+    {
+        s_maxVertices = s_maxVertices ? 2 * s_maxVertices : 1024;
+        s_positions = realloc( s_positions, 3 * s_maxVertices * sizeof( float ));
+        s_normals = realloc( s_normals, 3 * s_maxVertices * sizeof( float ));
+        s_colors = realloc( s_colors, 3 * s_maxVertices * sizeof( float ));
+        s_uvs = realloc( s_uvs, 2 * s_maxVertices * sizeof( float ));
+    }
+
+    uint32_t i = s_numVertices++;
+    Vtx *v = &vdata[slot];
+
+    s_positions[3*i + 0] = v->v.ob[0];
+    s_positions[3*i + 1] = v->v.ob[1];
+    s_positions[3*i + 2] = v->v.ob[2];
+
+    // Stored unit length so a rotation-only normal matrix can skip renormalizing them every tick
+    s_normals[3*i + 0] = ((float)v->n.n[0]) / 128.0f;
+    s_normals[3*i + 1] = ((float)v->n.n[1]) / 128.0f;
+    s_normals[3*i + 2] = ((float)v->n.n[2]) / 128.0f;
+    if( s_normals[3*i + 0] != 0.0f || s_normals[3*i + 1] != 0.0f || s_normals[3*i + 2] != 0.0f )
+        vec3f_normalize( &s_normals[3*i] );
+
+    memcpy( &s_colors[3*i], s_curColor, sizeof( s_curColor ));
+
+    if( s_textureOn )
+    {
+        convert_uv_to_atlas( &s_uvs[2*i], v->v.tc );
+    }
+    else
+    {
+        s_uvs[2*i + 0] = 1.0f;
+        s_uvs[2*i + 1] = 1.0f;
+    }
+
+    uint16_t local = list->numVertices++;
+
+    if( cached )
+        s_vertexSlots[slot] = (int16_t)local;
+
+    return local;
+}
+
+static void add_compiled_triangle( Vtx *vdata, intptr_t v00, intptr_t v01, intptr_t v02 )
+{
+    struct CompiledDisplayList *list = s_buildList;
+
+    if( s_numIndices + 3 > s_maxIndices )
+    {
+        s_maxIndices = s_maxIndices ? 2 * s_maxIndices : 3072;
+        s_indices = realloc( s_indices, s_maxIndices * sizeof( uint16_t ));
+    }
+
+    s_indices[s_numIndices++] = add_compiled_vertex( vdata, v00 );
+    s_indices[s_numIndices++] = add_compiled_vertex( vdata, v01 );
+    s_indices[s_numIndices++] = add_compiled_vertex( vdata, v02 );
+    list->numIndices += 3;
+}
+
 static void process_display_list( void *dl )
 {
     intptr_t *ptr = (intptr_t *)dl;
@@ -48,12 +205,14 @@ static void process_display_list( void *dl )
     {
         switch( *ptr++ )
         {
-            case GFXCMD_VertexData: 
+            case GFXCMD_VertexData:
             {
                 UNUSED intptr_t v = *ptr++;
                 UNUSED intptr_t n = *ptr++;
                 UNUSED intptr_t v0 = *ptr++;
                 vdata = (Vtx*)v;
+                s_numVertexSlots = n;
+                invalidate_vertex_slots();
                 break;
             }
 
@@ -64,65 +223,7 @@ static void process_display_list( void *dl )
                 intptr_t v02 = *ptr++;
                 UNUSED intptr_t flag0 = *ptr++;
 
-                float x0 = vdata[v00].v.ob[0], y0 = vdata[v00].v.ob[1], z0 = vdata[v00].v.ob[2];
-                float x1 = vdata[v01].v.ob[0], y1 = vdata[v01].v.ob[1], z1 = vdata[v01].v.ob[2];
-                float x2 = vdata[v02].v.ob[0], y2 = vdata[v02].v.ob[1], z2 = vdata[v02].v.ob[2];
-                Vec3f p0 = { (float)x0, (float)y0, (float)z0 };
-                Vec3f p1 = { (float)x1, (float)y1, (float)z1 };
-                Vec3f p2 = { (float)x2, (float)y2, (float)z2 };
-
-                signed char nx0 = vdata[v00].n.n[0], ny0 = vdata[v00].n.n[1], nz0 = vdata[v00].n.n[2];
-                signed char nx1 = vdata[v01].n.n[0], ny1 = vdata[v01].n.n[1], nz1 = vdata[v01].n.n[2];
-                signed char nx2 = vdata[v02].n.n[0], ny2 = vdata[v02].n.n[1], nz2 = vdata[v02].n.n[2];
-                Vec3f n0 = { ((float)nx0) / 128.0f, ((float)ny0) / 128.0f, ((float)nz0) / 128.0f };
-                Vec3f n1 = { ((float)nx1) / 128.0f, ((float)ny1) / 128.0f, ((float)nz1) / 128.0f };
-                Vec3f n2 = { ((float)nx2) / 128.0f, ((float)ny2) / 128.0f, ((float)nz2) / 128.0f };
-
-                mtxf_mul_vec3f_x( s_curMatrix, p0, 1.0f, s_trianglePtr );
-                s_trianglePtr += 3;
-                mtxf_mul_vec3f_x( s_curMatrix, p1, 1.0f, s_trianglePtr );
-                s_trianglePtr += 3;
-                mtxf_mul_vec3f_x( s_curMatrix, p2, 1.0f, s_trianglePtr );
-                s_trianglePtr += 3;
-
-                // TODO normals arent correct under non-uniform scale. multiply by inverse/transpose
-                mtxf_mul_vec3f_x( s_curMatrix, n0, 0.0f, s_normalPtr );
-                vec3f_normalize( s_normalPtr );
-                s_normalPtr += 3;
-                mtxf_mul_vec3f_x( s_curMatrix, n1, 0.0f, s_normalPtr );
-                vec3f_normalize( s_normalPtr );
-                s_normalPtr += 3;
-                mtxf_mul_vec3f_x( s_curMatrix, n2, 0.0f, s_normalPtr );
-                vec3f_normalize( s_normalPtr );
-                s_normalPtr += 3;
-
-                *s_colorPtr++ = s_curColor[0];
-                *s_colorPtr++ = s_curColor[1];
-                *s_colorPtr++ = s_curColor[2];
-                *s_colorPtr++ = s_curColor[0];
-                *s_colorPtr++ = s_curColor[1];
-                *s_colorPtr++ = s_curColor[2];
-                *s_colorPtr++ = s_curColor[0];
-                *s_colorPtr++ = s_curColor[1];
-                *s_colorPtr++ = s_curColor[2];
-
-                if( s_textureOn )
-                {
-                    convert_uv_to_atlas( s_uvPtr, vdata[v00].v.tc ); s_uvPtr += 2;
-                    convert_uv_to_atlas( s_uvPtr, vdata[v01].v.tc ); s_uvPtr += 2;
-                    convert_uv_to_atlas( s_uvPtr, vdata[v02].v.tc ); s_uvPtr += 2;
-                }
-                else
-                {
-                    *s_uvPtr++ = 1.0f;
-                    *s_uvPtr++ = 1.0f;
-                    *s_uvPtr++ = 1.0f;
-                    *s_uvPtr++ = 1.0f;
-                    *s_uvPtr++ = 1.0f;
-                    *s_uvPtr++ = 1.0f;
-                }
-
-                s_outBuffers->numTrianglesUsed = (uint16_t)((s_trianglePtr - s_outBuffers->position) / 9);
+                add_compiled_triangle( vdata, v00, v01, v02 );
 
                 break;
             }
@@ -139,7 +240,8 @@ static void process_display_list( void *dl )
                     s_curColor[1] = (float)data->l.col[1] / 255.0f;
                     s_curColor[2] = (float)data->l.col[2] / 255.0f;
                 }
-                
+                invalidate_vertex_slots();
+
                 break;
             }
 
@@ -152,6 +254,7 @@ static void process_display_list( void *dl )
                 s_scaleS = (uint16_t)s;
                 s_scaleT = (uint16_t)t;
                 s_textureOn = (int)on;
+                invalidate_vertex_slots();
 
                 break;
             }
@@ -163,6 +266,7 @@ static void process_display_list( void *dl )
                 s_textureIndex = (int)i;
                 s_texWidth = mario_tex_widths[s_textureIndex];
                 s_texHeight = mario_tex_heights[s_textureIndex];
+                invalidate_vertex_slots();
 
                 break;
             }
@@ -176,7 +280,8 @@ static void process_display_list( void *dl )
 
                 s_uls = (uint16_t)uls;
                 s_ult = (uint16_t)ult;
-                
+                invalidate_vertex_slots();
+
                 break;
             }
 
@@ -184,6 +289,7 @@ static void process_display_list( void *dl )
             {
                 intptr_t dl = *ptr++;
                 process_display_list( (void*)dl );
+                invalidate_vertex_slots(); // vdata is back to ours
                 break;
             }
 
@@ -196,22 +302,499 @@ break_top:
     {}
 }
 
+static uint32_t hash_display_list( void *dl )
+{
+    return (uint32_t)(((uintptr_t)dl >> 3) * 2654435761u) & (s_listHashSize - 1);
+}
+
+static int32_t find_compiled_display_list( void *dl )
+{
+    if( s_listHashSize == 0 )
+        return -1;
+
+    for( uint32_t h = hash_display_list( dl );; h = (h + 1) & (s_listHashSize - 1) )
+    {
+        uint16_t i = s_listHash[h];
+        if( i == 0 || s_lists[i - 1].displayList == dl )
+            return (int32_t)i - 1;
+    }
+}
+
+static void insert_compiled_display_list( uint32_t index )
+{
+    uint32_t h = hash_display_list( s_lists[index].displayList );
+    while( s_listHash[h] != 0 )
+        h = (h + 1) & (s_listHashSize - 1);
+    s_listHash[h] = (uint16_t)(index + 1);
+}
+
+// Keeps the table at most half full, doubling it and reinserting every list when it would go over
+static void reserve_list_hash( uint32_t numLists )
+{
+    if( numLists <= s_listHashSize / 2 )
+        return;
+
+    uint32_t size = s_listHashSize ? s_listHashSize : LIST_HASH_INITIAL_SIZE;
+    while( numLists > size / 2 )
+        size *= 2;
+
+    free( s_listHash );
+    s_listHash = calloc( size, sizeof( uint16_t ));
+    s_listHashSize = size;
+
+    for( uint32_t i = 0; i < s_numLists; ++i )
+        insert_compiled_display_list( i );
+}
+
+static int32_t compile_display_list( void *dl )
+{
+    int32_t found = find_compiled_display_list( dl );
+    if( found >= 0 )
+        return found;
+
+    // The hash stores index + 1 in 16 bits, far more than Mario's display lists will ever need
+    if( s_numLists >= UINT16_MAX )
+    {
+        DEBUG_PRINT("Too many display lists to compile, skipping %p", dl);
+        return -1;
+    }
+
+    s_lists = realloc( s_lists, (s_numLists + 1) * sizeof( struct CompiledDisplayList ));
+    struct CompiledDisplayList *list = &s_lists[s_numLists];
+    list->displayList = dl;
+    list->firstVertex = s_numVertices;
+    list->firstIndex = s_numIndices;
+    list->numVertices = 0;
+    list->numIndices = 0;
+
+    // Every list is compiled from the default render state, Mario's display lists all set their own lights and textures
+    s_curColor[0] = s_curColor[1] = s_curColor[2] = 0.0f;
+    s_textureOn = 0;
+
+    s_buildList = list;
+    process_display_list( dl );
+    s_buildList = NULL;
+
+    if( list->numVertices > s_maxScratchVertices )
+    {
+        s_maxScratchVertices = list->numVertices;
+        s_scratchPositions = realloc( s_scratchPositions, 3 * s_maxScratchVertices * sizeof( float ));
+        s_scratchNormals = realloc( s_scratchNormals, 3 * s_maxScratchVertices * sizeof( float ));
+    }
+
+    reserve_list_hash( s_numLists + 1 );
+    insert_compiled_display_list( s_numLists );
+
+    return (int32_t)s_numLists++;
+}
+
+static void compile_graph_node_and_siblings( struct GraphNode *firstNode )
+{
+    struct GraphNode *node = firstNode;
+
+    do {
+        void *dl = NULL;
+
+        switch( node->type )
+        {
+            case GRAPH_NODE_TYPE_TRANSLATION_ROTATION: dl = ((struct GraphNodeTranslationRotation *)node)->displayList; break;
+            case GRAPH_NODE_TYPE_TRANSLATION:          dl = ((struct GraphNodeTranslation *)node)->displayList; break;
+            case GRAPH_NODE_TYPE_ROTATION:             dl = ((struct GraphNodeRotation *)node)->displayList; break;
+            case GRAPH_NODE_TYPE_ANIMATED_PART:        dl = ((struct GraphNodeAnimatedPart *)node)->displayList; break;
+            case GRAPH_NODE_TYPE_BILLBOARD:            dl = ((struct GraphNodeBillboard *)node)->displayList; break;
+            case GRAPH_NODE_TYPE_DISPLAY_LIST:         dl = ((struct GraphNodeDisplayList *)node)->displayList; break;
+            case GRAPH_NODE_TYPE_SCALE:                dl = ((struct GraphNodeScale *)node)->displayList; break;
+        }
+
+        if( dl != NULL )
+            compile_display_list( dl );
+
+        if( node->children != NULL )
+            compile_graph_node_and_siblings( node->children );
+    } while(( node = node->next ) != firstNode );
+}
+
+static void transform_compiled_display_list( struct CompiledDisplayList *list, float *outPositions, float *outNormals )
+{
+    gfx_transform_positions( *s_curMatrix, &s_positions[3 * list->firstVertex], outPositions, list->numVertices );
+
+    if( s_curNormalMatrixIsRotation )
+        gfx_transform_vectors( s_curNormalMatrix, &s_normals[3 * list->firstVertex], outNormals, list->numVertices );
+    else
+        gfx_transform_normals( s_curNormalMatrix, &s_normals[3 * list->firstVertex], outNormals, list->numVertices );
+}
+
+static void draw_compiled_display_list( struct CompiledDisplayList *list )
+{
+    if( s_outBuffers->flags & SM64_GEO_FLAG_INDEXED )
+    {
+        transform_compiled_display_list( list, s_trianglePtr, s_normalPtr );
+        s_trianglePtr += 3 * list->numVertices;
+        s_normalPtr += 3 * list->numVertices;
+        s_outBuffers->numVerticesUsed += list->numVertices;
+    }
+    else
+    {
+        const uint16_t *indices = &s_indices[list->firstIndex];
+
+        transform_compiled_display_list( list, s_scratchPositions, s_scratchNormals );
+
+        for( uint16_t i = 0; i < list->numIndices; ++i )
+        {
+            const float *p = &s_scratchPositions[3 * indices[i]];
+            const float *n = &s_scratchNormals[3 * indices[i]];
+
+            *s_trianglePtr++ = p[0];
+            *s_trianglePtr++ = p[1];
+            *s_trianglePtr++ = p[2];
+            *s_normalPtr++ = n[0];
+            *s_normalPtr++ = n[1];
+            *s_normalPtr++ = n[2];
+        }
+    }
+
+    s_outBuffers->numTrianglesUsed += list->numIndices / 3;
+}
+
+static uint32_t get_topology_id( uint32_t indexed )
+{
+    for( uint32_t i = 0; i < s_numTopologies; ++i )
+    {
+        struct Topology *t = &s_topologies[i];
+        if( t->indexed == indexed && t->numLists == s_numDrawnLists && memcmp( t->lists, s_drawnLists, s_numDrawnLists * sizeof( uint16_t )) == 0 )
+            return t->id;
+    }
+
+    s_topologies = realloc( s_topologies, (s_numTopologies + 1) * sizeof( struct Topology ));
+    struct Topology *t = &s_topologies[s_numTopologies++];
+    t->id = s_nextTopologyId++;
+    t->indexed = indexed;
+    t->numLists = s_numDrawnLists;
+    t->lists = malloc( s_numDrawnLists * sizeof( uint16_t ));
+    memcpy( t->lists, s_drawnLists, s_numDrawnLists * sizeof( uint16_t ));
+
+    return t->id;
+}
+
+static void write_indices( void )
+{
+    uint16_t *indexPtr = s_outBuffers->index;
+    uint16_t base = 0;
+
+    for( uint32_t i = 0; i < s_numDrawnLists; ++i )
+    {
+        struct CompiledDisplayList *list = &s_lists[s_drawnLists[i]];
+        const uint16_t *indices = &s_indices[list->firstIndex];
+
+        for( uint16_t j = 0; j < list->numIndices; ++j )
+            *indexPtr++ = base + indices[j];
+
+        base += list->numVertices;
+    }
+}
+
+static void write_static_attributes( void )
+{
+    float *colorPtr = s_outBuffers->color;
+    float *uvPtr = s_outBuffers->uv;
+
+    for( uint32_t i = 0; i < s_numDrawnLists; ++i )
+    {
+        struct CompiledDisplayList *list = &s_lists[s_drawnLists[i]];
+        const float *colors = &s_colors[3 * list->firstVertex];
+        const float *uvs = &s_uvs[2 * list->firstVertex];
+
+        if( s_outBuffers->flags & SM64_GEO_FLAG_INDEXED )
+        {
+            memcpy( colorPtr, colors, 3 * list->numVertices * sizeof( float ));
+            colorPtr += 3 * list->numVertices;
+            memcpy( uvPtr, uvs, 2 * list->numVertices * sizeof( float ));
+            uvPtr += 2 * list->numVertices;
+            continue;
+        }
+
+        const uint16_t *indices = &s_indices[list->firstIndex];
+
+        for( uint16_t j = 0; j < list->numIndices; ++j )
+        {
+            uint16_t k = indices[j];
+            *colorPtr++ = colors[3*k + 0];
+            *colorPtr++ = colors[3*k + 1];
+            *colorPtr++ = colors[3*k + 2];
+            *uvPtr++ = uvs[2*k + 0];
+            *uvPtr++ = uvs[2*k + 1];
+        }
+    }
+}
+
+/**
+ * Normals are transformed by the inverse transpose of the model matrix's upper 3x3, which is its
+ * cofactor matrix divided by the determinant. When the matrix is a rotation with a uniform scale s
+ * that comes out as the rotation divided by s, so it's multiplied back by s to keep unit normals
+ * unit length and the per-vertex normalize is skipped. Anything else (non-uniform scale, shear)
+ * still gets normalized after the transform.
+ */
+static void update_normal_matrix( void )
+{
+    f32 (*m)[4] = *s_curMatrix;
+
+    Mat4 cof;
+    mtxf_identity( cof );
+    cof[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    cof[0][1] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    cof[0][2] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    cof[1][0] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    cof[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    cof[1][2] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    cof[2][0] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    cof[2][1] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    cof[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+    float det = m[0][0] * cof[0][0] + m[0][1] * cof[0][1] + m[0][2] * cof[0][2];
+
+    if( det == 0.0f )
+    {
+        // Degenerate (e.g. scaled to zero), keep the old behaviour of transforming by the model matrix
+        mtxf_copy( s_curNormalMatrix, *s_curMatrix );
+        s_curNormalMatrixIsRotation = false;
+        return;
+    }
+
+    float lengthSq[3], maxDot = 0.0f;
+    for( int i = 0; i < 3; ++i )
+        lengthSq[i] = m[i][0] * m[i][0] + m[i][1] * m[i][1] + m[i][2] * m[i][2];
+    for( int i = 0; i < 3; ++i )
+    {
+        int j = (i + 1) % 3;
+        float dot = fabsf( m[i][0] * m[j][0] + m[i][1] * m[j][1] + m[i][2] * m[j][2] );
+        if( dot > maxDot ) maxDot = dot;
+    }
+
+    const float tolerance = 1e-4f * lengthSq[0];
+    s_curNormalMatrixIsRotation =
+        fabsf( lengthSq[1] - lengthSq[0] ) <= tolerance &&
+        fabsf( lengthSq[2] - lengthSq[0] ) <= tolerance &&
+        maxDot <= tolerance;
+
+    float scale = 1.0f / det;
+    if( s_curNormalMatrixIsRotation )
+        scale *= sqrtf( lengthSq[0] );
+
+    mtxf_copy( s_curNormalMatrix, cof );
+    for( int i = 0; i < 3; ++i )
+        for( int j = 0; j < 3; ++j )
+            s_curNormalMatrix[i][j] *= scale;
+}
+
+static uint32_t hash_drawn_lists( uint32_t indexed )
+{
+    uint32_t hash = 2166136261u ^ indexed;
+
+    for( uint32_t i = 0; i < s_numDrawnLists; ++i )
+    {
+        const uint32_t *words = (const uint32_t *)s_drawnMatrices[i];
+        hash = ( hash ^ s_drawnLists[i] ) * 16777619u;
+        for( int j = 0; j < 16; ++j )
+            hash = ( hash ^ words[j] ) * 16777619u;
+    }
+
+    return hash;
+}
+
+static struct PoseMemoEntry *find_pose_memo( uint32_t hash, uint32_t indexed )
+{
+    for( uint32_t i = 0; i < POSE_MEMO_ENTRIES; ++i )
+    {
+        struct PoseMemoEntry *entry = &s_poseMemo[i];
+        if( entry->positions != NULL && entry->hash == hash && entry->indexed == indexed && entry->numLists == s_numDrawnLists &&
+            memcmp( entry->lists, s_drawnLists, s_numDrawnLists * sizeof( uint16_t )) == 0 &&
+            memcmp( entry->matrices, s_drawnMatrices, s_numDrawnLists * sizeof( Mat4 )) == 0 )
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void draw_local_space_lists( void )
+{
+    uint32_t indexed = s_outBuffers->flags & SM64_GEO_FLAG_INDEXED;
+    uint32_t hash = hash_drawn_lists( indexed );
+
+    if( s_poseMemo == NULL )
+        s_poseMemo = calloc( POSE_MEMO_ENTRIES, sizeof( struct PoseMemoEntry ));
+
+    struct PoseMemoEntry *entry = find_pose_memo( hash, indexed );
+    if( entry != NULL )
+    {
+        memcpy( s_outBuffers->position, entry->positions, entry->numFloats * sizeof( float ));
+        memcpy( s_outBuffers->normal, entry->normals, entry->numFloats * sizeof( float ));
+        s_outBuffers->numTrianglesUsed = entry->numTriangles;
+        s_outBuffers->numVerticesUsed = entry->numVertices;
+        return;
+    }
+
+    for( uint32_t i = 0; i < s_numDrawnLists; ++i )
+    {
+        s_curMatrix = &s_drawnMatrices[i];
+        update_normal_matrix();
+        draw_compiled_display_list( &s_lists[s_drawnLists[i]] );
+    }
+    s_curMatrix = &s_loadedMatrix;
+
+    entry = &s_poseMemo[s_nextPoseMemo];
+    s_nextPoseMemo = ( s_nextPoseMemo + 1 ) % POSE_MEMO_ENTRIES;
+
+    entry->hash = hash;
+    entry->indexed = indexed;
+    entry->numLists = s_numDrawnLists;
+    memcpy( entry->lists, s_drawnLists, s_numDrawnLists * sizeof( uint16_t ));
+    memcpy( entry->matrices, s_drawnMatrices, s_numDrawnLists * sizeof( Mat4 ));
+    entry->numTriangles = s_outBuffers->numTrianglesUsed;
+    entry->numVertices = s_outBuffers->numVerticesUsed;
+    entry->numFloats = (uint32_t)( s_trianglePtr - s_outBuffers->position );
+
+    if( entry->numFloats > entry->maxFloats )
+    {
+        entry->maxFloats = entry->numFloats;
+        entry->positions = realloc( entry->positions, entry->maxFloats * sizeof( float ));
+        entry->normals = realloc( entry->normals, entry->maxFloats * sizeof( float ));
+    }
+
+    memcpy( entry->positions, s_outBuffers->position, entry->numFloats * sizeof( float ));
+    memcpy( entry->normals, s_outBuffers->normal, entry->numFloats * sizeof( float ));
+}
+
 void gSPMatrix( void *pkt, Mtx *m, uint8_t flags )
 {
-    guMtxL2F( s_curMatrix, m );
+    // Vertices come out in model space, there's no projection to apply
+    if( flags & G_MTX_PROJECTION )
+        return;
+
+    guMtxL2F( s_loadedMatrix, m );
+    s_curMatrix = &s_loadedMatrix;
+    if( !( s_outBuffers->flags & SM64_GEO_FLAG_LOCAL_SPACE ))
+        update_normal_matrix();
+}
+
+void gSPMatrixF( void *pkt, Mat4 *m )
+{
+    // Only read while drawing the display lists that follow, so no need to copy it
+    s_curMatrix = m;
+    if( !( s_outBuffers->flags & SM64_GEO_FLAG_LOCAL_SPACE ))
+        update_normal_matrix();
 }
 
 void gSPDisplayList( void *pkt, struct DisplayListNode *dl )
 {
-    process_display_list( (void*)dl );
+    if( s_numDrawnLists == MAX_DRAWN_LISTS )
+    {
+        DEBUG_PRINT("Too many display lists drawn in one tick, skipping %p", (void*)dl);
+        return;
+    }
+
+    // Lists that weren't reachable from the graph at init get compiled the first time they're drawn
+    int32_t i = compile_display_list( (void*)dl );
+    if( i < 0 )
+        return;
+
+    if( s_outBuffers->flags & SM64_GEO_FLAG_LOCAL_SPACE )
+        mtxf_copy( s_drawnMatrices[s_numDrawnLists], *s_curMatrix );
+    else
+        draw_compiled_display_list( &s_lists[i] );
+
+    s_drawnLists[s_numDrawnLists++] = (uint16_t)i;
+}
+
+void gfx_adapter_compile_graph( struct GraphNode *root )
+{
+    gfx_kernels_select( GFX_KERNEL_AVX );
+    compile_graph_node_and_siblings( root );
 }
 
 void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffers )
 {
     s_outBuffers = outBuffers;
     s_trianglePtr = s_outBuffers->position;
-    s_colorPtr = s_outBuffers->color;
     s_normalPtr = s_outBuffers->normal;
-    s_uvPtr = s_outBuffers->uv;
     s_outBuffers->numTrianglesUsed = 0;
-}
\ No newline at end of file
+    s_outBuffers->numVerticesUsed = 0;
+    s_outBuffers->dirtyFlags = 0;
+    s_numDrawnLists = 0;
+}
+
+bool gfx_adapter_set_root_transform( Mat4 transform )
+{
+    if( !( s_outBuffers->flags & SM64_GEO_FLAG_LOCAL_SPACE ))
+        return false;
+
+    memcpy( s_outBuffers->transform, transform, sizeof( s_outBuffers->transform ));
+    return true;
+}
+
+void gfx_adapter_finish_output_buffers( void )
+{
+    uint32_t flags = s_outBuffers->flags;
+
+    if( flags & SM64_GEO_FLAG_LOCAL_SPACE )
+        draw_local_space_lists();
+
+    uint32_t topologyId = get_topology_id( flags & SM64_GEO_FLAG_INDEXED );
+    bool changed = s_outBuffers->topologyId != topologyId;
+
+    if( changed && ( flags & SM64_GEO_FLAG_INDEXED ))
+    {
+        write_indices();
+        s_outBuffers->dirtyFlags |= SM64_GEO_DIRTY_INDICES;
+    }
+
+    if( changed || !( flags & SM64_GEO_FLAG_STATIC_ATTRIBUTES ))
+    {
+        write_static_attributes();
+        s_outBuffers->dirtyFlags |= SM64_GEO_DIRTY_STATIC_ATTRIBUTES;
+    }
+
+    s_outBuffers->topologyId = topologyId;
+}
+
+void gfx_adapter_terminate( void )
+{
+    free( s_lists );
+    s_lists = NULL;
+    s_numLists = 0;
+    free( s_listHash );
+    s_listHash = NULL;
+    s_listHashSize = 0;
+
+    free( s_positions );
+    free( s_normals );
+    free( s_colors );
+    free( s_uvs );
+    free( s_indices );
+    s_positions = s_normals = s_colors = s_uvs = NULL;
+    s_indices = NULL;
+    s_numVertices = s_maxVertices = 0;
+    s_numIndices = s_maxIndices = 0;
+
+    free( s_scratchPositions );
+    free( s_scratchNormals );
+    s_scratchPositions = s_scratchNormals = NULL;
+    s_maxScratchVertices = 0;
+
+    for( uint32_t i = 0; i < s_numTopologies; ++i )
+        free( s_topologies[i].lists );
+    free( s_topologies );
+    s_topologies = NULL;
+    s_numTopologies = 0;
+
+    if( s_poseMemo != NULL )
+    {
+        for( uint32_t i = 0; i < POSE_MEMO_ENTRIES; ++i )
+        {
+            free( s_poseMemo[i].positions );
+            free( s_poseMemo[i].normals );
+        }
+        free( s_poseMemo );
+        s_poseMemo = NULL;
+    }
+    s_nextPoseMemo = 0;
+}
@@ -10,6 +10,11 @@
 #define gDPFillRectangle(pkt, ulx, uly, lrx, lry) ({})
 #define gSPViewport(pkt, v) ({})
 extern void gSPMatrix( void *pkt, Mtx *m, uint8_t flags );
+extern void gSPMatrixF( void *pkt, Mat4 *m );
 extern void gSPDisplayList( void *pkt, struct DisplayListNode *dl );
 
-extern void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffers );
\ No newline at end of file
+extern void gfx_adapter_compile_graph( struct GraphNode *root );
+extern void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffers );
+extern bool gfx_adapter_set_root_transform( Mat4 transform );
+extern void gfx_adapter_finish_output_buffers( void );
+extern void gfx_adapter_terminate( void );
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "gfx_kernels.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && ( defined(__i386__) || defined(__x86_64__) )
+    #define GFX_KERNELS_X86
+    #include <immintrin.h>
+#endif
+
+GfxTransformKernel gfx_transform_positions = gfx_transform_positions_scalar;
+GfxTransformKernel gfx_transform_vectors = gfx_transform_vectors_scalar;
+GfxTransformKernel gfx_transform_normals = gfx_transform_normals_scalar;
+
+enum TransformMode
+{
+    TRANSFORM_POSITIONS,
+    TRANSFORM_VECTORS,
+    TRANSFORM_NORMALS
+};
+
+void gfx_transform_positions_scalar( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    for( uint32_t i = 0; i < count; ++i, in += 3, out += 3 )
+    {
+        out[0] = in[0] * mtx[0][0] + in[1] * mtx[1][0] + in[2] * mtx[2][0] + mtx[3][0];
+        out[1] = in[0] * mtx[0][1] + in[1] * mtx[1][1] + in[2] * mtx[2][1] + mtx[3][1];
+        out[2] = in[0] * mtx[0][2] + in[1] * mtx[1][2] + in[2] * mtx[2][2] + mtx[3][2];
+    }
+}
+
+void gfx_transform_vectors_scalar( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    for( uint32_t i = 0; i < count; ++i, in += 3, out += 3 )
+    {
+        out[0] = in[0] * mtx[0][0] + in[1] * mtx[1][0] + in[2] * mtx[2][0];
+        out[1] = in[0] * mtx[0][1] + in[1] * mtx[1][1] + in[2] * mtx[2][1];
+        out[2] = in[0] * mtx[0][2] + in[1] * mtx[1][2] + in[2] * mtx[2][2];
+    }
+}
+
+void gfx_transform_normals_scalar( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    for( uint32_t i = 0; i < count; ++i, in += 3, out += 3 )
+    {
+        float x = in[0] * mtx[0][0] + in[1] * mtx[1][0] + in[2] * mtx[2][0];
+        float y = in[0] * mtx[0][1] + in[1] * mtx[1][1] + in[2] * mtx[2][1];
+        float z = in[0] * mtx[0][2] + in[1] * mtx[1][2] + in[2] * mtx[2][2];
+        float invLength = 1.0f / sqrtf( x * x + y * y + z * z );
+
+        out[0] = x * invLength;
+        out[1] = y * invLength;
+        out[2] = z * invLength;
+    }
+}
+
+static void transform_scalar( Mat4 mtx, const float *in, float *out, uint32_t count, enum TransformMode mode )
+{
+    switch( mode )
+    {
+        case TRANSFORM_POSITIONS: gfx_transform_positions_scalar( mtx, in, out, count ); break;
+        case TRANSFORM_VECTORS:   gfx_transform_vectors_scalar( mtx, in, out, count ); break;
+        case TRANSFORM_NORMALS:   gfx_transform_normals_scalar( mtx, in, out, count ); break;
+    }
+}
+
+#ifdef GFX_KERNELS_X86
+
+/**
+ * The vector kernels work on groups of 4 (SSE2) or 8 (AVX) vertices. Each group is loaded as
+ * three registers of packed xyz, shuffled into one register per component, transformed with the
+ * matrix columns broadcast, and shuffled back. _mm256_shuffle_ps works within 128-bit lanes, so
+ * the AVX kernel builds its registers with vertices 0-3 in the low lane and 4-7 in the high lane
+ * and reuses exactly the same shuffles. Whatever doesn't fill a group goes through the scalar kernel.
+ */
+
+// a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3  ->  x = x0 x1 x2 x3, y = y0 y1 y2 y3, z = z0 z1 z2 z3
+#define DEINTERLEAVE_XYZ( SHUFFLE, a, b, c, x, y, z ) do { \
+    x = SHUFFLE( SHUFFLE( a, b, _MM_SHUFFLE( 2, 2, 3, 0 )), SHUFFLE( b, c, _MM_SHUFFLE( 1, 1, 2, 2 )), _MM_SHUFFLE( 2, 0, 1, 0 )); \
+    y = SHUFFLE( SHUFFLE( a, b, _MM_SHUFFLE( 0, 0, 1, 1 )), SHUFFLE( b, c, _MM_SHUFFLE( 2, 2, 3, 3 )), _MM_SHUFFLE( 2, 0, 2, 0 )); \
+    z = SHUFFLE( SHUFFLE( a, b, _MM_SHUFFLE( 1, 1, 2, 2 )), SHUFFLE( c, c, _MM_SHUFFLE( 3, 3, 0, 0 )), _MM_SHUFFLE( 2, 0, 2, 0 )); \
+} while(0)
+
+#define INTERLEAVE_XYZ( SHUFFLE, x, y, z, a, b, c ) do { \
+    a = SHUFFLE( SHUFFLE( x, y, _MM_SHUFFLE( 0, 0, 0, 0 )), SHUFFLE( z, x, _MM_SHUFFLE( 1, 1, 0, 0 )), _MM_SHUFFLE( 2, 0, 2, 0 )); \
+    b = SHUFFLE( SHUFFLE( y, z, _MM_SHUFFLE( 1, 1, 1, 1 )), SHUFFLE( x, y, _MM_SHUFFLE( 2, 2, 2, 2 )), _MM_SHUFFLE( 2, 0, 2, 0 )); \
+    c = SHUFFLE( SHUFFLE( z, x, _MM_SHUFFLE( 3, 3, 2, 2 )), SHUFFLE( y, z, _MM_SHUFFLE( 3, 3, 3, 3 )), _MM_SHUFFLE( 2, 0, 2, 0 )); \
+} while(0)
+
+__attribute__((target("sse2")))
+static void transform_sse2( Mat4 mtx, const float *in, float *out, uint32_t count, enum TransformMode mode )
+{
+    __m128 m[4][3];
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 3; ++j )
+            m[i][j] = _mm_set1_ps( mtx[i][j] );
+
+    uint32_t groups = count / 4;
+
+    for( uint32_t g = 0; g < groups; ++g, in += 12, out += 12 )
+    {
+        __m128 a = _mm_loadu_ps( in + 0 );
+        __m128 b = _mm_loadu_ps( in + 4 );
+        __m128 c = _mm_loadu_ps( in + 8 );
+        __m128 x, y, z;
+
+        DEINTERLEAVE_XYZ( _mm_shuffle_ps, a, b, c, x, y, z );
+
+        __m128 ox = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, m[0][0] ), _mm_mul_ps( y, m[1][0] )), _mm_mul_ps( z, m[2][0] ));
+        __m128 oy = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, m[0][1] ), _mm_mul_ps( y, m[1][1] )), _mm_mul_ps( z, m[2][1] ));
+        __m128 oz = _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, m[0][2] ), _mm_mul_ps( y, m[1][2] )), _mm_mul_ps( z, m[2][2] ));
+
+        if( mode == TRANSFORM_NORMALS )
+        {
+            __m128 lengthSq = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ox, ox ), _mm_mul_ps( oy, oy )), _mm_mul_ps( oz, oz ));
+            __m128 invLength = _mm_div_ps( _mm_set1_ps( 1.0f ), _mm_sqrt_ps( lengthSq ));
+            ox = _mm_mul_ps( ox, invLength );
+            oy = _mm_mul_ps( oy, invLength );
+            oz = _mm_mul_ps( oz, invLength );
+        }
+        else if( mode == TRANSFORM_POSITIONS )
+        {
+            ox = _mm_add_ps( ox, m[3][0] );
+            oy = _mm_add_ps( oy, m[3][1] );
+            oz = _mm_add_ps( oz, m[3][2] );
+        }
+
+        INTERLEAVE_XYZ( _mm_shuffle_ps, ox, oy, oz, a, b, c );
+
+        _mm_storeu_ps( out + 0, a );
+        _mm_storeu_ps( out + 4, b );
+        _mm_storeu_ps( out + 8, c );
+    }
+
+    transform_scalar( mtx, in, out, count % 4, mode );
+}
+
+__attribute__((target("sse2")))
+static void transform_positions_sse2( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    transform_sse2( mtx, in, out, count, TRANSFORM_POSITIONS );
+}
+
+__attribute__((target("sse2")))
+static void transform_vectors_sse2( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    transform_sse2( mtx, in, out, count, TRANSFORM_VECTORS );
+}
+
+__attribute__((target("sse2")))
+static void transform_normals_sse2( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    transform_sse2( mtx, in, out, count, TRANSFORM_NORMALS );
+}
+
+__attribute__((target("avx")))
+static __m256 load_halves_avx( const float *lo, const float *hi )
+{
+    return _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( lo )), _mm_loadu_ps( hi ), 1 );
+}
+
+__attribute__((target("avx")))
+static void store_halves_avx( float *lo, float *hi, __m256 v )
+{
+    _mm_storeu_ps( lo, _mm256_castps256_ps128( v ));
+    _mm_storeu_ps( hi, _mm256_extractf128_ps( v, 1 ));
+}
+
+__attribute__((target("avx")))
+static void transform_avx( Mat4 mtx, const float *in, float *out, uint32_t count, enum TransformMode mode )
+{
+    __m256 m[4][3];
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 3; ++j )
+            m[i][j] = _mm256_set1_ps( mtx[i][j] );
+
+    uint32_t groups = count / 8;
+
+    for( uint32_t g = 0; g < groups; ++g, in += 24, out += 24 )
+    {
+        __m256 a = load_halves_avx( in + 0, in + 12 );
+        __m256 b = load_halves_avx( in + 4, in + 16 );
+        __m256 c = load_halves_avx( in + 8, in + 20 );
+        __m256 x, y, z;
+
+        DEINTERLEAVE_XYZ( _mm256_shuffle_ps, a, b, c, x, y, z );
+
+        __m256 ox = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( x, m[0][0] ), _mm256_mul_ps( y, m[1][0] )), _mm256_mul_ps( z, m[2][0] ));
+        __m256 oy = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( x, m[0][1] ), _mm256_mul_ps( y, m[1][1] )), _mm256_mul_ps( z, m[2][1] ));
+        __m256 oz = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( x, m[0][2] ), _mm256_mul_ps( y, m[1][2] )), _mm256_mul_ps( z, m[2][2] ));
+
+        if( mode == TRANSFORM_NORMALS )
+        {
+            __m256 lengthSq = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ox, ox ), _mm256_mul_ps( oy, oy )), _mm256_mul_ps( oz, oz ));
+            __m256 invLength = _mm256_div_ps( _mm256_set1_ps( 1.0f ), _mm256_sqrt_ps( lengthSq ));
+            ox = _mm256_mul_ps( ox, invLength );
+            oy = _mm256_mul_ps( oy, invLength );
+            oz = _mm256_mul_ps( oz, invLength );
+        }
+        else if( mode == TRANSFORM_POSITIONS )
+        {
+            ox = _mm256_add_ps( ox, m[3][0] );
+            oy = _mm256_add_ps( oy, m[3][1] );
+            oz = _mm256_add_ps( oz, m[3][2] );
+        }
+
+        INTERLEAVE_XYZ( _mm256_shuffle_ps, ox, oy, oz, a, b, c );
+
+        store_halves_avx( out + 0, out + 12, a );
+        store_halves_avx( out + 4, out + 16, b );
+        store_halves_avx( out + 8, out + 20, c );
+    }
+
+    // At most 7 left over, the SSE2 kernel takes a group of 4 before falling back to scalar
+    transform_sse2( mtx, in, out, count % 8, mode );
+}
+
+__attribute__((target("avx")))
+static void transform_positions_avx( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    transform_avx( mtx, in, out, count, TRANSFORM_POSITIONS );
+}
+
+__attribute__((target("avx")))
+static void transform_vectors_avx( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    transform_avx( mtx, in, out, count, TRANSFORM_VECTORS );
+}
+
+__attribute__((target("avx")))
+static void transform_normals_avx( Mat4 mtx, const float *in, float *out, uint32_t count )
+{
+    transform_avx( mtx, in, out, count, TRANSFORM_NORMALS );
+}
+
+#endif // GFX_KERNELS_X86
+
+enum GfxKernelLevel gfx_kernels_select( enum GfxKernelLevel maxLevel )
+{
+#ifdef GFX_KERNELS_X86
+    __builtin_cpu_init();
+
+    if( maxLevel >= GFX_KERNEL_AVX && __builtin_cpu_supports( "avx" ))
+    {
+        gfx_transform_positions = transform_positions_avx;
+        gfx_transform_vectors = transform_vectors_avx;
+        gfx_transform_normals = transform_normals_avx;
+        return GFX_KERNEL_AVX;
+    }
+
+    if( maxLevel >= GFX_KERNEL_SSE2 && __builtin_cpu_supports( "sse2" ))
+    {
+        gfx_transform_positions = transform_positions_sse2;
+        gfx_transform_vectors = transform_vectors_sse2;
+        gfx_transform_normals = transform_normals_sse2;
+        return GFX_KERNEL_SSE2;
+    }
+#endif
+
+    gfx_transform_positions = gfx_transform_positions_scalar;
+    gfx_transform_vectors = gfx_transform_vectors_scalar;
+    gfx_transform_normals = gfx_transform_normals_scalar;
+    return GFX_KERNEL_SCALAR;
+}
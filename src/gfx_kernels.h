@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "decomp/include/types.h"
+
+enum GfxKernelLevel
+{
+    GFX_KERNEL_SCALAR,
+    GFX_KERNEL_SSE2,
+    GFX_KERNEL_AVX
+};
+
+typedef void (*GfxTransformKernel)( Mat4 mtx, const float *in, float *out, uint32_t count );
+
+// Transform `count` packed xyz vectors by mtx. Positions get the translation row, vectors and
+// normals don't, and normals are normalized afterwards. `in` and `out` must not overlap.
+extern GfxTransformKernel gfx_transform_positions;
+extern GfxTransformKernel gfx_transform_vectors;
+extern GfxTransformKernel gfx_transform_normals;
+
+extern void gfx_transform_positions_scalar( Mat4 mtx, const float *in, float *out, uint32_t count );
+extern void gfx_transform_vectors_scalar( Mat4 mtx, const float *in, float *out, uint32_t count );
+extern void gfx_transform_normals_scalar( Mat4 mtx, const float *in, float *out, uint32_t count );
+
+// Picks the widest kernels the CPU supports up to maxLevel and returns the level actually used.
+extern enum GfxKernelLevel gfx_kernels_select( enum GfxKernelLevel maxLevel );
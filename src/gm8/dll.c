@@ -12,30 +12,12 @@
 #include <png.h>
 #include "../libsm64.h"
 #include "../load_surfaces.h"
+#include "../file_map.h"
 
 #include "audio.h"
 
 #define DLLEXPORT __declspec(dllexport)
 
-uint8_t *utils_read_file_alloc( const char *path, size_t *fileLength )
-{
-    FILE *f = fopen( path, "rb" );
-
-    if( !f ) return NULL;
-
-    fseek( f, 0, SEEK_END );
-    size_t length = (size_t)ftell( f );
-    rewind( f );
-    uint8_t *buffer = (uint8_t*)malloc( length + 1 );
-    fread( buffer, 1, length, f );
-    buffer[length] = 0;
-    fclose( f );
-
-    if( fileLength ) *fileLength = length;
-
-    return buffer;
-}
-
 static int save_png(const char* filename, int width, int height,
                      int bitdepth, int colortype,
                      unsigned char* data, int pitch, int transform)
@@ -140,32 +122,89 @@ static struct SM64MarioGeometryBuffers marioGeometry;
 static struct SM64Surface* surfaces;
 static size_t surfaces_count;
 
+static struct FileMap initRom;
+static uint8_t *initTexture;
+
+static void finish_init(bool cached, bool audio)
+{
+	if (!cached || access("texture.png", F_OK) != 0)
+		save_png("texture.png", SM64_TEXTURE_WIDTH, SM64_TEXTURE_HEIGHT, 8, PNG_COLOR_TYPE_RGB_ALPHA, initTexture, 4*SM64_TEXTURE_WIDTH, PNG_TRANSFORM_IDENTITY);
+
+    if (audio)
+        gm8_audio_init();
+
+    free(initTexture);
+    initTexture = NULL;
+    file_map_close(&initRom);
+
+	surfaces = 0;
+	surfaces_count = 0;
+}
+
 DLLEXPORT double gm8_libsm64_init()
 {
-    size_t romSize;
-    uint8_t *rom = utils_read_file_alloc( "sm64.us.z64", &romSize );
+    sm64_global_terminate();
+    free(initTexture);
+    initTexture = NULL;
+
+    file_map_close(&initRom);
+    if (!file_map_open(&initRom, "sm64.us.z64")) return 0;
+
+    // Everything reads at fixed offsets up to the end of the ROM
+    if (initRom.size < SM64_ROM_SIZE)
+    {
+        file_map_close(&initRom);
+        return 0;
+    }
+
+    initTexture = (uint8_t*)malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
 
-    if (!rom) return 0;
+    bool cached = sm64_global_init_cached( initRom.data, initTexture, "sm64.us.cache" );
+    bool audio = sm64_audio_init_from_path("sm64.us.z64");
 
-    uint8_t *texture = (uint8_t*)malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
+    finish_init(cached, audio);
 
+    return 1;
+}
+
+// Same as gm8_libsm64_init but returns right away, call gm8_libsm64_init_poll every step until it returns 1
+DLLEXPORT double gm8_libsm64_init_async()
+{
     sm64_global_terminate();
-    sm64_global_init( rom, texture );
-    sm64_audio_init(rom);
+    free(initTexture);
+    initTexture = NULL;
 
-	save_png("texture.png", SM64_TEXTURE_WIDTH, SM64_TEXTURE_HEIGHT, 8, PNG_COLOR_TYPE_RGB_ALPHA, texture, 4*SM64_TEXTURE_WIDTH, PNG_TRANSFORM_IDENTITY);
+    file_map_close(&initRom);
+    if (!file_map_open(&initRom, "sm64.us.z64")) return 0;
 
-    gm8_audio_init();
+    if (initRom.size < SM64_ROM_SIZE)
+    {
+        file_map_close(&initRom);
+        return 0;
+    }
 
-    free(texture);
-    free(rom);
+    initTexture = (uint8_t*)malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
 
-	surfaces = 0;
-	surfaces_count = 0;
+    sm64_global_init_async( initRom.data, initTexture, "sm64.us.cache", true );
 
     return 1;
 }
 
+// Returns the loading progress, below 1 until everything is ready
+DLLEXPORT double gm8_libsm64_init_poll()
+{
+    float progress;
+    enum SM64InitStatus status = sm64_init_poll( &progress );
+
+    if (status == SM64_INIT_IN_PROGRESS)
+        return progress < 0.99f ? progress : 0.99f;
+
+    if (status == SM64_INIT_DONE && initRom.data)
+        finish_init(sm64_init_cache_hit(), true);
+
+    return status == SM64_INIT_DONE ? 1 : 0;
+}
+
 // [Binary] i copypasted this from libsm64-gzdoom lol
 DLLEXPORT double gm8_libsm64_remove_static_surfaces(double removeCount)
 {
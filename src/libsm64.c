@@ -9,6 +9,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "decomp/audio/external.h"
 #include "decomp/include/PR/os_cont.h"
@@ -32,22 +33,92 @@
 #include "load_surfaces.h"
 #include "gfx_adapter.h"
 #include "load_anim_data.h"
+#include "asset_cache.h"
+#include "file_map.h"
 #include "load_audio_data.h"
 #include "load_tex_data.h"
+#include "texture_atlas.h"
 #include "obj_pool.h"
+#include "mario_instance.h"
+#include "mario_snapshot.h"
+#include "replay.h"
+#include "net_state.h"
+#include "mario_commands.h"
+#include "profile.h"
+#include "anim_pose_cache.h"
 #include "fake_interaction.h"
 
 static struct AllocOnlyPool *s_mario_geo_pool = NULL;
 static struct GraphNode *s_mario_graph_node = NULL;
+static struct GeoFlatGraph *s_mario_flat_graph = NULL;
 
 static bool s_init_global = false;
 static bool s_init_one_mario = false;
+static uint32_t s_texture_flags = 0;
 
-struct MarioInstance
+// State of sm64_global_init_async. The worker bumps s_init_stages_done as each stage finishes and
+// sets s_init_finished last, sm64_init_poll joins it once that's seen.
+struct AsyncInitJob
 {
-    struct GlobalState *globalState;
+    const uint8_t *rom;
+    uint8_t *outTexture;
+    const char *cachePath;
+    bool initAudio;
 };
-struct ObjPool s_mario_instance_pool = { 0, 0 };
+
+static struct AsyncInitJob s_init_job;
+static pthread_t s_init_thread;
+static bool s_init_thread_running = false;
+static uint32_t s_init_stage_count = 0;
+static uint32_t s_init_stages_done = 0;
+static int s_init_finished = 0;
+static bool s_init_cache_hit = false;
+
+struct ObjPool s_mario_instance_pool = OBJ_POOL_INIT( struct MarioInstance );
+
+// Setters queued while s_defer_setters is on, one buffer per pool slot. Kept outside of the
+// instance so snapshots don't pick up heap pointers.
+static bool s_defer_setters = false;
+static struct MarioCommandBuffer *s_mario_command_buffers = NULL;
+static uint32_t s_mario_command_buffer_count = 0;
+
+static void apply_mario_command( int32_t marioId, enum ReplayOp op, const union ReplayArg *a, uint32_t numArgs );
+
+static struct MarioInstance *bind_mario_instance( int32_t marioId )
+{
+    struct MarioInstance *instance = obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId );
+    if( instance != NULL )
+        global_state_bind( &instance->globalState );
+    return instance;
+}
+
+static struct MarioCommandBuffer *get_mario_command_buffer( int32_t marioId )
+{
+    uint32_t slot = OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId );
+
+    if( slot >= s_mario_command_buffer_count )
+    {
+        uint32_t newCount = s_mario_instance_pool.capacity;
+        s_mario_command_buffers = realloc( s_mario_command_buffers, newCount * sizeof( struct MarioCommandBuffer ));
+        memset( s_mario_command_buffers + s_mario_command_buffer_count, 0, ( newCount - s_mario_command_buffer_count ) * sizeof( struct MarioCommandBuffer ));
+        s_mario_command_buffer_count = newCount;
+    }
+
+    return &s_mario_command_buffers[slot];
+}
+
+static void flush_mario_commands( int32_t marioId )
+{
+    if( OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId ) >= s_mario_command_buffer_count )
+        return;
+
+    struct MarioCommandBuffer *buffer = get_mario_command_buffer( marioId );
+
+    for( uint32_t i = 0; i < buffer->count; ++i )
+        apply_mario_command( marioId, buffer->commands[i].op, buffer->commands[i].args, buffer->commands[i].numArgs );
+
+    buffer->count = 0;
+}
 
 static void update_button( bool on, u16 button )
 {
@@ -66,22 +137,15 @@ static void update_button( bool on, u16 button )
     }
 }
 
-static struct Area *allocate_area( void )
+static struct Area *init_area( struct Area *area, struct Camera *camera )
 {
-    struct Area *result = malloc( sizeof( struct Area ));
-    memset( result, 0, sizeof( struct Area ));
+    memset( area, 0, sizeof( struct Area ));
+    memset( camera, 0, sizeof( struct Camera ));
 
-    result->flags = 1;
-    result->camera = malloc( sizeof( struct Camera ));
-    memset( result->camera, 0, sizeof( struct Camera ));
+    area->flags = 1;
+    area->camera = camera;
 
-    return result;
-}
-
-static void free_area( struct Area *area )
-{
-    free( area->camera );
-    free( area );
+    return area;
 }
 
 typedef void (*SM64DebugPrintFunctionPtr)( const char * );
@@ -97,6 +161,16 @@ SM64_LIB_FN void sm64_register_play_sound_function( SM64PlaySoundFunctionPtr pla
 }
 
 
+static void global_init_mario_graph( void )
+{
+    memory_init();
+
+    s_mario_geo_pool = alloc_only_pool_init();
+    s_mario_graph_node = process_geo_layout( s_mario_geo_pool, mario_geo_ptr );
+    gfx_adapter_compile_graph( s_mario_graph_node );
+    s_mario_flat_graph = geo_flatten_graph( s_mario_graph_node );
+}
+
 SM64_LIB_FN void sm64_global_init( const uint8_t *rom, uint8_t *outTexture )
 {
     if( s_init_global )
@@ -104,45 +178,260 @@ SM64_LIB_FN void sm64_global_init( const uint8_t *rom, uint8_t *outTexture )
 
     s_init_global = true;
 
-    load_mario_textures_from_rom( rom, outTexture );
+    load_mario_textures_from_rom( rom, outTexture, s_texture_flags );
     load_mario_anims_from_rom( rom );
+    texture_atlas_store( outTexture, s_texture_flags );
 
-    memory_init();
+    global_init_mario_graph();
+}
+
+SM64_LIB_FN void sm64_set_texture_flags( uint32_t flags )
+{
+    s_texture_flags = flags;
+}
+
+SM64_LIB_FN size_t sm64_texture_atlas_export( enum SM64TextureFormat format, uint32_t mipLevels, uint8_t *out )
+{
+    if( !s_init_global ) return 0;
+    return texture_atlas_export( format, mipLevels, out );
+}
+
+SM64_LIB_FN bool sm64_global_init_from_path( const char *romPath, uint8_t *outTexture )
+{
+    struct FileMap rom;
+    if( !file_map_open( &rom, romPath ))
+    {
+        DEBUG_PRINT("Failed to map ROM: %s", romPath);
+        return false;
+    }
+
+    // The texture and animation tables point anywhere up to the end of the 8MB US ROM, so anything
+    // shorter would have them read past the mapping
+    if( rom.size < SM64_ROM_SIZE )
+    {
+        DEBUG_PRINT("ROM is too small (%u bytes): %s", (uint32_t)rom.size, romPath);
+        file_map_close( &rom );
+        return false;
+    }
+
+    // Everything is decoded or copied out of the ROM, so the mapping isn't needed afterwards
+    sm64_global_init( rom.data, outTexture );
+    file_map_close( &rom );
+    return true;
+}
+
+SM64_LIB_FN bool sm64_global_init_cached( const uint8_t *rom, uint8_t *outTexture, const char *cachePath )
+{
+    if( s_init_global )
+        sm64_global_terminate();
+
+    s_init_global = true;
+
+    bool hit = asset_cache_load( cachePath, rom, outTexture, s_texture_flags );
+    s_init_cache_hit = hit;
+    if( !hit )
+    {
+        load_mario_textures_from_rom( rom, outTexture, s_texture_flags );
+        load_mario_anims_from_rom( rom );
+        asset_cache_save( cachePath, rom, outTexture, s_texture_flags );
+    }
+
+    texture_atlas_store( outTexture, s_texture_flags );
+    global_init_mario_graph();
+    return hit;
+}
+
+static void *init_texture_stage( void *arg )
+{
+    load_mario_textures_from_rom( s_init_job.rom, s_init_job.outTexture, s_texture_flags );
+    __atomic_add_fetch( &s_init_stages_done, 1, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+static void *init_audio_stage( void *arg )
+{
+    load_audio_banks( s_init_job.rom );
+    __atomic_add_fetch( &s_init_stages_done, 1, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+// Runs the stage on its own thread, or right away if one can't be created
+static bool start_init_stage( pthread_t *thread, void *(*stage)( void * ))
+{
+    if( pthread_create( thread, NULL, stage, NULL ) == 0 )
+        return true;
+
+    stage( NULL );
+    return false;
+}
+
+static void *init_worker( void *arg )
+{
+    pthread_t audio_thread, texture_thread;
+    bool audio_threaded = s_init_job.initAudio && start_init_stage( &audio_thread, init_audio_stage );
+
+    if( s_init_job.cachePath && asset_cache_load( s_init_job.cachePath, s_init_job.rom, s_init_job.outTexture, s_texture_flags ))
+    {
+        s_init_cache_hit = true;
+        __atomic_add_fetch( &s_init_stages_done, 2, __ATOMIC_RELEASE );
+    }
+    else
+    {
+        bool texture_threaded = start_init_stage( &texture_thread, init_texture_stage );
+
+        load_mario_anims_from_rom( s_init_job.rom );
+        __atomic_add_fetch( &s_init_stages_done, 1, __ATOMIC_RELEASE );
+
+        if( texture_threaded )
+            pthread_join( texture_thread, NULL );
+
+        if( s_init_job.cachePath )
+            asset_cache_save( s_init_job.cachePath, s_init_job.rom, s_init_job.outTexture, s_texture_flags );
+    }
+
+    texture_atlas_store( s_init_job.outTexture, s_texture_flags );
+    global_init_mario_graph();
+    __atomic_add_fetch( &s_init_stages_done, 1, __ATOMIC_RELEASE );
+
+    if( audio_threaded )
+        pthread_join( audio_thread, NULL );
+
+    __atomic_store_n( &s_init_finished, 1, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+SM64_LIB_FN void sm64_global_init_async( const uint8_t *rom, uint8_t *outTexture, const char *cachePath, bool initAudio )
+{
+    if( s_init_global )
+        sm64_global_terminate();
+
+    s_init_global = true;
+
+    s_init_job.rom = rom;
+    s_init_job.outTexture = outTexture;
+    s_init_job.cachePath = cachePath;
+    s_init_job.initAudio = initAudio;
+
+    // Textures, animations and the graph, plus the audio banks
+    s_init_stage_count = initAudio ? 4 : 3;
+    s_init_stages_done = 0;
+    s_init_finished = 0;
+    s_init_cache_hit = false;
+
+    s_init_thread_running = start_init_stage( &s_init_thread, init_worker );
+}
+
+SM64_LIB_FN enum SM64InitStatus sm64_init_poll( float *outProgress )
+{
+    if( s_init_thread_running && __atomic_load_n( &s_init_finished, __ATOMIC_ACQUIRE ))
+    {
+        pthread_join( s_init_thread, NULL );
+        s_init_thread_running = false;
+    }
+
+    if( outProgress )
+    {
+        if( s_init_thread_running )
+            *outProgress = (float)__atomic_load_n( &s_init_stages_done, __ATOMIC_ACQUIRE ) / (float)s_init_stage_count;
+        else
+            *outProgress = s_init_global ? 1.0f : 0.0f;
+    }
+
+    if( s_init_thread_running )
+        return SM64_INIT_IN_PROGRESS;
+
+    return s_init_global ? SM64_INIT_DONE : SM64_INIT_NOT_STARTED;
+}
+
+SM64_LIB_FN bool sm64_init_cache_hit( void )
+{
+    // The worker writes it before its finished flag, which sm64_init_poll has seen once it's joined
+    return !s_init_thread_running && s_init_cache_hit;
 }
 
 SM64_LIB_FN void sm64_global_terminate( void )
 {
+    if( s_init_thread_running )
+    {
+        pthread_join( s_init_thread, NULL );
+        s_init_thread_running = false;
+    }
+
     if( !s_init_global ) return;
 
     global_state_bind( NULL );
 
     if( s_init_one_mario )
     {
-        for( int i = 0; i < s_mario_instance_pool.size; ++i )
-            if( s_mario_instance_pool.objects[i] != NULL )
-                sm64_mario_delete( i );
+        for( uint32_t i = 0; i < s_mario_instance_pool.capacity; ++i )
+        {
+            uint32_t handle = obj_pool_handle_at( &s_mario_instance_pool, i );
+            if( handle != OBJ_POOL_INVALID_HANDLE )
+                sm64_mario_delete( (int32_t)handle );
+        }
 
         obj_pool_free_all( &s_mario_instance_pool );
     }
 
+    for( uint32_t i = 0; i < s_mario_command_buffer_count; ++i )
+        mario_command_buffer_free( &s_mario_command_buffers[i] );
+    free( s_mario_command_buffers );
+    s_mario_command_buffers = NULL;
+    s_mario_command_buffer_count = 0;
+    s_defer_setters = false;
+
+    PROFILE_TERMINATE();
+
     s_init_global = false;
     s_init_one_mario = false;
+    s_init_cache_hit = false;
+
+    if( s_mario_flat_graph )
+    {
+        geo_free_flat_graph( s_mario_flat_graph );
+        s_mario_flat_graph = NULL;
+    }
 
     if( s_mario_geo_pool )
     {
         alloc_only_pool_free( s_mario_geo_pool );
         s_mario_geo_pool = NULL;
+        s_mario_graph_node = NULL;
     }
 
     surfaces_unload_all();
+    anim_pose_cache_clear();
     unload_mario_anims();
+    asset_cache_terminate();
+    texture_atlas_free();
+    gfx_adapter_terminate();
     memory_terminate();
+    replay_terminate();
+}
+
+SM64_LIB_FN void sm64_prewarm_animations( void )
+{
+    if( !s_init_global ) return;
+    prewarm_mario_anims();
+}
+
+SM64_LIB_FN void sm64_set_anim_pose_cache_budget( size_t bytes )
+{
+    anim_pose_cache_set_budget( bytes );
 }
 
 SM64_LIB_FN void sm64_audio_init( const uint8_t *rom ) {
     load_audio_banks( rom );
 }
 
+SM64_LIB_FN bool sm64_audio_init_from_path( const char *romPath ) {
+    if( !load_audio_banks_from_path( romPath )) {
+        DEBUG_PRINT("Failed to map ROM: %s", romPath);
+        return false;
+    }
+    return true;
+}
+
 #define SAMPLES_HIGH 544
 #define SAMPLES_LOW 528
 
@@ -170,22 +459,23 @@ SM64_LIB_FN void sm64_static_surfaces_load( const struct SM64Surface *surfaceArr
 
 SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z )
 {
-    int32_t marioIndex = obj_pool_alloc_index( &s_mario_instance_pool, sizeof( struct MarioInstance ));
-    struct MarioInstance *newInstance = s_mario_instance_pool.objects[marioIndex];
-
-    newInstance->globalState = global_state_create();
-    global_state_bind( newInstance->globalState );
+    int32_t marioIndex = (int32_t)obj_pool_alloc( &s_mario_instance_pool );
+    struct MarioInstance *newInstance = obj_pool_get( &s_mario_instance_pool, (uint32_t)marioIndex );
 
-    if( !s_init_one_mario )
+    if( newInstance == NULL )
     {
-        s_init_one_mario = true;
-        s_mario_geo_pool = alloc_only_pool_init();
-        s_mario_graph_node = process_geo_layout( s_mario_geo_pool, mario_geo_ptr );
+        DEBUG_PRINT("Failed to create Mario, the instance pool is full");
+        return -1;
     }
 
+    global_state_init( &newInstance->globalState );
+    global_state_bind( &newInstance->globalState );
+
+    s_init_one_mario = true;
+
     gCurrSaveFileNum = 1;
-    gMarioObject = hack_allocate_mario();
-    gCurrentArea = allocate_area();
+    gMarioObject = hack_allocate_mario( &newInstance->marioObject );
+    gCurrentArea = init_area( &newInstance->area, &newInstance->camera );
     gCurrentObject = gMarioObject;
 
     gMarioSpawnInfoVal.startPos[0] = x;
@@ -214,18 +504,23 @@ SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z )
     set_mario_action( gMarioState, ACT_SPAWN_SPIN_AIRBORNE, 0);
     find_floor( x, y, z, &gMarioState->floor );
 
+    REPLAY_RECORD_CALL( REPLAY_OP_MARIO_CREATE, marioIndex, REPLAY_F( x ), REPLAY_F( y ), REPLAY_F( z ));
+
     return marioIndex;
 }
 
 SM64_LIB_FN void sm64_mario_tick( int32_t marioId, const struct SM64MarioInputs *inputs, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( bind_mario_instance( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", marioId);
         return;
     }
 
-    global_state_bind( ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState );
+    PROFILE_BEGIN_TICK( OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId ));
+    PROFILE_BEGIN( SM64_PROFILE_PHASE_TICK );
+
+    flush_mario_commands( marioId );
 
     update_button( inputs->buttonA, A_BUTTON );
     update_button( inputs->buttonB, B_BUTTON );
@@ -241,13 +536,25 @@ SM64_LIB_FN void sm64_mario_tick( int32_t marioId, const struct SM64MarioInputs
     gController.stickY = 64.0f * inputs->stickY;
     gController.stickMag = sqrtf( gController.stickX*gController.stickX + gController.stickY*gController.stickY );
 
+    PROFILE_BEGIN( SM64_PROFILE_PHASE_PLATFORM_DISPLACEMENT );
     apply_mario_platform_displacement();
+    PROFILE_END( SM64_PROFILE_PHASE_PLATFORM_DISPLACEMENT );
+
+    PROFILE_BEGIN( SM64_PROFILE_PHASE_MARIO_UPDATE );
     bhv_mario_update();
+    PROFILE_END( SM64_PROFILE_PHASE_MARIO_UPDATE );
+
+    PROFILE_BEGIN( SM64_PROFILE_PHASE_PLATFORM_UPDATE );
     update_mario_platform(); // TODO platform grabbed here and used next tick could be a use-after-free
+    PROFILE_END( SM64_PROFILE_PHASE_PLATFORM_UPDATE );
 
+    PROFILE_BEGIN( SM64_PROFILE_PHASE_GEO_PROCESS );
     gfx_adapter_bind_output_buffers( outBuffers );
 
-    geo_process_root_hack_single_node( s_mario_graph_node );
+    geo_process_root_hack_single_node( s_mario_graph_node, s_mario_flat_graph );
+
+    gfx_adapter_finish_output_buffers();
+    PROFILE_END( SM64_PROFILE_PHASE_GEO_PROCESS );
 
     gAreaUpdateCounter++;
 
@@ -259,354 +566,409 @@ SM64_LIB_FN void sm64_mario_tick( int32_t marioId, const struct SM64MarioInputs
     outState->flags = gMarioState->flags;
     outState->particleFlags = gMarioState->particleFlags;
     outState->invincTimer = gMarioState->invincTimer;
+
+    PROFILE_END( SM64_PROFILE_PHASE_TICK );
+    PROFILE_END_TICK();
+
+    if( g_replay_recording )
+        replay_record_mario_tick( (uint32_t)marioId, inputs, outState );
 }
 
 SM64_LIB_FN void sm64_mario_delete( int32_t marioId )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( bind_mario_instance( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to delete non-existant Mario with ID: %u", marioId);
         return;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+    if( g_replay_recording )
+        replay_record_call( REPLAY_OP_MARIO_DELETE, marioId, NULL, 0 );
+
+    if( OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId ) < s_mario_command_buffer_count )
+        get_mario_command_buffer( marioId )->count = 0;
+
+    PROFILE_RESET( OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId ));
 
     if ( g_is_audio_initialized ) {
         stop_sound(SOUND_MARIO_SNORING3, gMarioState->marioObj->header.gfx.cameraToObject);
     }
 
-    free( gMarioObject );
-    free_area( gCurrentArea );
+    obj_pool_free( &s_mario_instance_pool, (uint32_t)marioId );
+}
 
-    global_state_delete( globalState );
-    obj_pool_free_index( &s_mario_instance_pool, marioId );
+SM64_LIB_FN size_t sm64_mario_snapshot_size( void )
+{
+    return mario_snapshot_size();
 }
 
-SM64_LIB_FN void sm64_set_mario_action(int32_t marioId, uint32_t action)
+SM64_LIB_FN bool sm64_mario_snapshot_save( int32_t marioId, void *buffer )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    struct MarioInstance *instance = obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId );
+    if( instance == NULL )
     {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
+        DEBUG_PRINT("Tried to snapshot non-existant Mario with ID: %d", marioId);
+        return false;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    set_mario_action(gMarioState, action, 0);
+    mario_snapshot_save( instance, buffer );
+    return true;
 }
 
-SM64_LIB_FN void sm64_set_mario_action_arg(int32_t marioId, uint32_t action, uint32_t actionArg)
+SM64_LIB_FN bool sm64_mario_snapshot_load( int32_t marioId, const void *buffer )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    struct MarioInstance *instance = obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId );
+    if( instance == NULL )
     {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
+        DEBUG_PRINT("Tried to restore non-existant Mario with ID: %d", marioId);
+        return false;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+    if( !mario_snapshot_load( instance, buffer ))
+    {
+        DEBUG_PRINT("Snapshot for Mario with ID %d was made by a different build of libsm64", marioId);
+        return false;
+    }
 
-    set_mario_action(gMarioState, action, actionArg);
+    return true;
 }
 
-SM64_LIB_FN void sm64_set_mario_animation(int32_t marioId, int32_t animID)
+SM64_LIB_FN void sm64_replay_record_start( void )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
+    replay_record_start();
+}
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+SM64_LIB_FN const uint8_t *sm64_replay_record_stop( size_t *outSize )
+{
+    return replay_record_stop( outSize );
+}
 
-    set_mario_animation(gMarioState, animID);
+SM64_LIB_FN uint32_t sm64_replay_run( const uint8_t *stream, size_t size, uint32_t *outTickHashes, uint32_t maxTickHashes, int32_t *outFirstMismatch )
+{
+    return replay_run( stream, size, outTickHashes, maxTickHashes, outFirstMismatch );
 }
 
-SM64_LIB_FN void sm64_set_mario_anim_frame(int32_t marioId, int16_t animFrame)
+SM64_LIB_FN uint32_t sm64_mario_state_hash( const struct SM64MarioState *state )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    return replay_hash_mario_state( state );
+}
+
+SM64_LIB_FN bool sm64_mario_get_net_state( int32_t marioId, struct SM64MarioNetState *outState )
+{
+    if( bind_mario_instance( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
+        return false;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+    net_state_from_mario( gMarioState, outState );
+    return true;
+}
 
-    gMarioState->marioObj->header.gfx.animInfo.animFrame = animFrame;
+SM64_LIB_FN uint32_t sm64_net_state_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *state, uint8_t *outBuffer, uint32_t bufferSize )
+{
+    return net_state_encode( baseline, state, outBuffer, bufferSize );
 }
 
-SM64_LIB_FN void sm64_set_mario_state(int32_t marioId, uint32_t flags)
+SM64_LIB_FN uint32_t sm64_net_state_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t bufferSize, struct SM64MarioNetState *outState )
+{
+    return net_state_decode( baseline, buffer, bufferSize, outState );
+}
+
+// Runs a setter on the Mario that's currently bound, whether it was called directly or queued
+static void apply_mario_command( int32_t marioId, enum ReplayOp op, const union ReplayArg *a, uint32_t numArgs )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( g_replay_recording )
+        replay_record_call( op, (uint32_t)marioId, a, numArgs );
+
+    switch( op )
     {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
+        case REPLAY_OP_SET_MARIO_ACTION:
+            set_mario_action(gMarioState, a[0].u, 0);
+            break;
+
+        case REPLAY_OP_SET_MARIO_ACTION_ARG:
+            set_mario_action(gMarioState, a[0].u, a[1].u);
+            break;
+
+        case REPLAY_OP_SET_MARIO_ANIMATION:
+            set_mario_animation(gMarioState, a[0].s);
+            break;
+
+        case REPLAY_OP_SET_MARIO_ANIM_FRAME:
+            gMarioState->marioObj->header.gfx.animInfo.animFrame = (int16_t)a[0].s;
+            break;
+
+        case REPLAY_OP_SET_MARIO_STATE:
+            gMarioState->flags = a[0].u;
+            break;
+
+        case REPLAY_OP_SET_MARIO_POSITION:
+            gMarioState->pos[0] = a[0].f;
+            gMarioState->pos[1] = a[1].f;
+            gMarioState->pos[2] = a[2].f;
+            vec3f_copy(gMarioState->marioObj->header.gfx.pos, gMarioState->pos);
+            break;
+
+        case REPLAY_OP_SET_MARIO_ANGLE:
+            vec3s_set(gMarioState->faceAngle, (int16_t)(a[0].f / 3.14159f * 32768.f), (int16_t)(a[1].f / 3.14159f * 32768.f), (int16_t)(a[2].f / 3.14159f * 32768.f));
+            vec3s_copy(gMarioState->marioObj->header.gfx.angle, gMarioState->faceAngle);
+            break;
+
+        case REPLAY_OP_SET_MARIO_FACEANGLE:
+            gMarioState->faceAngle[1] = (int16_t)(a[0].f / 3.14159f * 32768.f);
+            vec3s_set(gMarioState->marioObj->header.gfx.angle, 0, gMarioState->faceAngle[1], 0);
+            break;
+
+        case REPLAY_OP_SET_MARIO_VELOCITY:
+            gMarioState->vel[0] = a[0].f;
+            gMarioState->vel[1] = a[1].f;
+            gMarioState->vel[2] = a[2].f;
+            break;
+
+        case REPLAY_OP_SET_MARIO_FORWARD_VELOCITY:
+            gMarioState->forwardVel = a[0].f;
+            break;
+
+        case REPLAY_OP_SET_MARIO_INVINCIBILITY:
+            gMarioState->invincTimer = (int16_t)a[0].s;
+            break;
+
+        case REPLAY_OP_SET_MARIO_WATER_LEVEL:
+            gMarioState->waterLevel = a[0].s;
+            break;
+
+        case REPLAY_OP_SET_MARIO_GAS_LEVEL:
+            gMarioState->gasLevel = a[0].s;
+            break;
+
+        case REPLAY_OP_SET_MARIO_HEALTH:
+            gMarioState->health = (uint16_t)a[0].u;
+            gMarioState->hurtCounter = 0;
+            gMarioState->healCounter = 0;
+            break;
+
+        case REPLAY_OP_MARIO_TAKE_DAMAGE:
+            fake_damage_knock_back(gMarioState, a[0].u, a[1].u, a[2].f, a[3].f, a[4].f);
+            break;
+
+        case REPLAY_OP_MARIO_HEAL:
+            gMarioState->healCounter += (uint8_t)a[0].u;
+            break;
+
+        case REPLAY_OP_MARIO_KILL:
+            gMarioState->health = 0xff;
+            break;
+
+        case REPLAY_OP_MARIO_INTERACT_CAP:
+        {
+            uint16_t capTime = (uint16_t)a[1].u;
+            uint16_t capMusic = 0;
+            if(gMarioState->action != ACT_GETTING_BLOWN && a[0].u != 0)
+            {
+                gMarioState->flags &= ~MARIO_CAP_ON_HEAD & ~MARIO_CAP_IN_HAND;
+                gMarioState->flags |= a[0].u;
+
+                switch(a[0].u)
+                {
+                    case MARIO_VANISH_CAP:
+                        if(capTime == 0) capTime = 600;
+                        capMusic = SEQUENCE_ARGS(4, SEQ_EVENT_POWERUP);
+                        break;
+                    case MARIO_METAL_CAP:
+                        if(capTime == 0) capTime = 600;
+                        capMusic = SEQUENCE_ARGS(4, SEQ_EVENT_METAL_CAP);
+                        break;
+                    case MARIO_WING_CAP:
+                        if(capTime == 0) capTime = 1800;
+                        capMusic = SEQUENCE_ARGS(4, SEQ_EVENT_POWERUP);
+                        break;
+                }
+
+                if (capTime > gMarioState->capTimer) {
+                    gMarioState->capTimer = capTime;
+                }
+
+                if ((gMarioState->action & ACT_FLAG_IDLE) || gMarioState->action == ACT_WALKING) {
+                    gMarioState->flags |= MARIO_CAP_IN_HAND;
+                    set_mario_action(gMarioState, ACT_PUTTING_ON_CAP, 0);
+                } else {
+                    gMarioState->flags |= MARIO_CAP_ON_HEAD;
+                }
+
+                play_sound(SOUND_MENU_STAR_SOUND, gMarioState->marioObj->header.gfx.cameraToObject);
+                play_sound(SOUND_MARIO_HERE_WE_GO, gMarioState->marioObj->header.gfx.cameraToObject);
+
+                if (a[2].u != 0 && capMusic != 0) {
+                    play_cap_music(capMusic);
+                }
+            }
+            break;
+        }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+        case REPLAY_OP_MARIO_EXTEND_CAP:
+            gMarioState->capTimer += (uint16_t)a[0].u;
+            break;
 
-    gMarioState->flags = flags;
+        default:
+            break;
+    }
 }
 
-SM64_LIB_FN void sm64_set_mario_position(int32_t marioId, float x, float y, float z)
+static void submit_mario_command( int32_t marioId, enum ReplayOp op, const union ReplayArg *args, uint32_t numArgs )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
         return;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+    if( s_defer_setters )
+    {
+        mario_command_buffer_push( get_mario_command_buffer( marioId ), op, args, numArgs );
+        return;
+    }
 
-    gMarioState->pos[0] = x;
-    gMarioState->pos[1] = y;
-    gMarioState->pos[2] = z;
-    vec3f_copy(gMarioState->marioObj->header.gfx.pos, gMarioState->pos);
+    bind_mario_instance( marioId );
+    apply_mario_command( marioId, op, args, numArgs );
 }
 
-SM64_LIB_FN void sm64_set_mario_angle(int32_t marioId, float x, float y, float z)
+#define SUBMIT_MARIO_COMMAND( marioId, op, ... ) do { \
+    union ReplayArg commandArgs_[] = { __VA_ARGS__ }; \
+    submit_mario_command( marioId, op, commandArgs_, sizeof( commandArgs_ ) / sizeof( commandArgs_[0] )); \
+} while( 0 )
+
+SM64_LIB_FN bool sm64_profile_get( int32_t marioId, struct SM64ProfileStats *outStats )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
+        return false;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    vec3s_set(gMarioState->faceAngle, (int16_t)(x / 3.14159f * 32768.f), (int16_t)(y / 3.14159f * 32768.f), (int16_t)(z / 3.14159f * 32768.f));
-    vec3s_copy(gMarioState->marioObj->header.gfx.angle, gMarioState->faceAngle);
+    return profile_get( OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId ), outStats );
 }
 
-SM64_LIB_FN void sm64_set_mario_faceangle(int32_t marioId, float y)
+SM64_LIB_FN void sm64_profile_reset( int32_t marioId )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
         return;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+    PROFILE_RESET( OBJ_POOL_HANDLE_SLOT( (uint32_t)marioId ));
+}
 
-    gMarioState->faceAngle[1] = (int16_t)(y / 3.14159f * 32768.f);
-    vec3s_set(gMarioState->marioObj->header.gfx.angle, 0, gMarioState->faceAngle[1], 0);
+SM64_LIB_FN void sm64_set_deferred_setters( bool deferred )
+{
+    s_defer_setters = deferred;
 }
 
-SM64_LIB_FN void sm64_set_mario_velocity(int32_t marioId, float x, float y, float z)
+SM64_LIB_FN void sm64_set_mario_action(int32_t marioId, uint32_t action)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_ACTION, REPLAY_U( action ));
+}
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+SM64_LIB_FN void sm64_set_mario_action_arg(int32_t marioId, uint32_t action, uint32_t actionArg)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_ACTION_ARG, REPLAY_U( action ), REPLAY_U( actionArg ));
+}
 
-    gMarioState->vel[0] = x;
-    gMarioState->vel[1] = y;
-    gMarioState->vel[2] = z;
+SM64_LIB_FN void sm64_set_mario_animation(int32_t marioId, int32_t animID)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_ANIMATION, REPLAY_S( animID ));
 }
 
-SM64_LIB_FN void sm64_set_mario_forward_velocity(int32_t marioId, float vel)
+SM64_LIB_FN void sm64_set_mario_anim_frame(int32_t marioId, int16_t animFrame)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_ANIM_FRAME, REPLAY_S( animFrame ));
+}
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+SM64_LIB_FN void sm64_set_mario_state(int32_t marioId, uint32_t flags)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_STATE, REPLAY_U( flags ));
+}
 
-    gMarioState->forwardVel = vel;
+SM64_LIB_FN void sm64_set_mario_position(int32_t marioId, float x, float y, float z)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_POSITION, REPLAY_F( x ), REPLAY_F( y ), REPLAY_F( z ));
 }
 
-SM64_LIB_FN void sm64_set_mario_invincibility(int32_t marioId, int16_t timer)
+SM64_LIB_FN void sm64_set_mario_angle(int32_t marioId, float x, float y, float z)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_ANGLE, REPLAY_F( x ), REPLAY_F( y ), REPLAY_F( z ));
+}
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+SM64_LIB_FN void sm64_set_mario_faceangle(int32_t marioId, float y)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_FACEANGLE, REPLAY_F( y ));
+}
 
-    gMarioState->invincTimer = timer;
+SM64_LIB_FN void sm64_set_mario_velocity(int32_t marioId, float x, float y, float z)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_VELOCITY, REPLAY_F( x ), REPLAY_F( y ), REPLAY_F( z ));
 }
 
-SM64_LIB_FN void sm64_set_mario_water_level(int32_t marioId, signed int level)
+SM64_LIB_FN void sm64_set_mario_forward_velocity(int32_t marioId, float vel)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_FORWARD_VELOCITY, REPLAY_F( vel ));
+}
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+SM64_LIB_FN void sm64_set_mario_invincibility(int32_t marioId, int16_t timer)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_INVINCIBILITY, REPLAY_S( timer ));
+}
 
-    gMarioState->waterLevel = level;
+SM64_LIB_FN void sm64_set_mario_water_level(int32_t marioId, signed int level)
+{
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_WATER_LEVEL, REPLAY_S( level ));
 }
 
 SM64_LIB_FN void sm64_set_mario_gas_level(int32_t marioId, signed int level)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    gMarioState->gasLevel = level;
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_GAS_LEVEL, REPLAY_S( level ));
 }
 
 SM64_LIB_FN void sm64_set_mario_health(int32_t marioId, uint16_t health)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    gMarioState->health = health;
-    gMarioState->hurtCounter = 0;
-    gMarioState->healCounter = 0;
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_SET_MARIO_HEALTH, REPLAY_U( health ));
 }
 
 SM64_LIB_FN void sm64_mario_take_damage(int32_t marioId, uint32_t damage, uint32_t subtype, float x, float y, float z)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    fake_damage_knock_back(gMarioState, damage, subtype, x, y, z);
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_MARIO_TAKE_DAMAGE, REPLAY_U( damage ), REPLAY_U( subtype ), REPLAY_F( x ), REPLAY_F( y ), REPLAY_F( z ));
 }
 
 SM64_LIB_FN void sm64_mario_heal(int32_t marioId, uint8_t healCounter)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    gMarioState->healCounter += healCounter;
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_MARIO_HEAL, REPLAY_U( healCounter ));
 }
 
 SM64_LIB_FN void sm64_mario_kill(int32_t marioId)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    gMarioState->health = 0xff;
+    submit_mario_command( marioId, REPLAY_OP_MARIO_KILL, NULL, 0 );
 }
 
 SM64_LIB_FN void sm64_mario_interact_cap(int32_t marioId, uint32_t capFlag, uint16_t capTime, uint8_t playMusic)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    uint16_t capMusic = 0;
-    if(gMarioState->action != ACT_GETTING_BLOWN && capFlag != 0)
-    {
-        gMarioState->flags &= ~MARIO_CAP_ON_HEAD & ~MARIO_CAP_IN_HAND;
-        gMarioState->flags |= capFlag;
-
-        switch(capFlag)
-        {
-            case MARIO_VANISH_CAP:
-                if(capTime == 0) capTime = 600;
-                capMusic = SEQUENCE_ARGS(4, SEQ_EVENT_POWERUP);
-                break;
-            case MARIO_METAL_CAP:
-                if(capTime == 0) capTime = 600;
-                capMusic = SEQUENCE_ARGS(4, SEQ_EVENT_METAL_CAP);
-                break;
-            case MARIO_WING_CAP:
-                if(capTime == 0) capTime = 1800;
-                capMusic = SEQUENCE_ARGS(4, SEQ_EVENT_POWERUP);
-                break;
-        }
-
-        if (capTime > gMarioState->capTimer) {
-            gMarioState->capTimer = capTime;
-        }
-
-        if ((gMarioState->action & ACT_FLAG_IDLE) || gMarioState->action == ACT_WALKING) {
-            gMarioState->flags |= MARIO_CAP_IN_HAND;
-            set_mario_action(gMarioState, ACT_PUTTING_ON_CAP, 0);
-        } else {
-            gMarioState->flags |= MARIO_CAP_ON_HEAD;
-        }
-
-        play_sound(SOUND_MENU_STAR_SOUND, gMarioState->marioObj->header.gfx.cameraToObject);
-        play_sound(SOUND_MARIO_HERE_WE_GO, gMarioState->marioObj->header.gfx.cameraToObject);
-
-        if (playMusic != 0 && capMusic != 0) {
-            play_cap_music(capMusic);
-        }
-    }
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_MARIO_INTERACT_CAP, REPLAY_U( capFlag ), REPLAY_U( capTime ), REPLAY_U( playMusic ));
 }
 
 SM64_LIB_FN void sm64_mario_extend_cap(int32_t marioId, uint16_t capTime)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
-        return;
-    }
-
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
-
-    gMarioState->capTimer += capTime;
+    SUBMIT_MARIO_COMMAND( marioId, REPLAY_OP_MARIO_EXTEND_CAP, REPLAY_U( capTime ));
 }
 
 SM64_LIB_FN bool sm64_mario_attack(int32_t marioId, float x, float y, float z, float hitboxHeight)
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+    if( bind_mario_instance( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
         return false;
     }
 
-    struct GlobalState *globalState = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-    global_state_bind( globalState );
+    REPLAY_RECORD_CALL( REPLAY_OP_MARIO_ATTACK, marioId, REPLAY_F( x ), REPLAY_F( y ), REPLAY_F( z ), REPLAY_F( hitboxHeight ) );
 
     return fake_interact_bounce_top(gMarioState, x, y, z, hitboxHeight);
 }
@@ -614,28 +976,39 @@ SM64_LIB_FN bool sm64_mario_attack(int32_t marioId, float x, float y, float z, f
 SM64_LIB_FN uint32_t sm64_surface_object_create( const struct SM64SurfaceObject *surfaceObject )
 {
     uint32_t id = surfaces_load_object( surfaceObject );
+
+    if( g_replay_recording )
+        replay_record_surface_object_create( id, surfaceObject );
+
     return id;
 }
 
 SM64_LIB_FN void sm64_surface_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform )
 {
     surface_object_update_transform( objectId, transform );
+
+    if( g_replay_recording )
+        replay_record_surface_object_move( objectId, transform );
 }
 
 SM64_LIB_FN void sm64_surface_object_delete( uint32_t objectId )
 {
     // A mario standing on the platform that is being destroyed will have a pointer to freed memory if we don't clear it.
-    for( int i = 0; i < s_mario_instance_pool.size; ++i )
+    for( uint32_t i = 0; i < s_mario_instance_pool.capacity; ++i )
     {
-        if( s_mario_instance_pool.objects[i] == NULL )
+        struct MarioInstance *instance = obj_pool_get( &s_mario_instance_pool, obj_pool_handle_at( &s_mario_instance_pool, i ));
+        if( instance == NULL )
             continue;
 
-        struct GlobalState *state = ((struct MarioInstance *)s_mario_instance_pool.objects[ i ])->globalState;
+        struct GlobalState *state = &instance->globalState;
         if( state->mgMarioObject->platform == surfaces_object_get_transform_ptr( objectId ))
             state->mgMarioObject->platform = NULL;
     }
 
     surfaces_unload_object( objectId );
+
+    if( g_replay_recording )
+        replay_record_call( REPLAY_OP_SURFACE_OBJECT_DELETE, objectId, NULL, 0 );
 }
 
 
@@ -61,6 +61,18 @@ struct SM64MarioState
     int16_t invincTimer;
 };
 
+struct SM64MarioNetState
+{
+    float position[3];
+    float velocity[3];
+    float faceAngle;
+    int16_t health;
+    uint32_t action;
+    uint32_t flags;
+    int16_t animID;
+    int16_t animFrame;
+};
+
 struct SM64MarioGeometryBuffers
 {
     float *position;
@@ -68,6 +80,14 @@ struct SM64MarioGeometryBuffers
     float *color;
     float *uv;
     uint16_t numTrianglesUsed;
+
+    // Everything below is optional, leaving it zeroed keeps the unindexed triangle output.
+    uint32_t flags;           // SM64_GEO_FLAG_* bits, set by the host
+    uint16_t *index;          // SM64_GEO_FLAG_INDEXED: 3 * SM64_GEO_MAX_TRIANGLES entries
+    uint16_t numVerticesUsed; // SM64_GEO_FLAG_INDEXED: unique vertices written to position/normal/color/uv
+    uint32_t dirtyFlags;      // SM64_GEO_DIRTY_* bits, set by sm64_mario_tick
+    uint32_t topologyId;      // Used by libsm64 to track what's in the buffers, don't modify
+    float transform[16];      // SM64_GEO_FLAG_LOCAL_SPACE: model matrix in OpenGL's column-major layout, set by sm64_mario_tick
 };
 
 struct SM64WallCollisionData
@@ -131,6 +151,77 @@ enum
     SM64_TEXTURE_WIDTH = 64 * 11,
     SM64_TEXTURE_HEIGHT = 64,
     SM64_GEO_MAX_TRIANGLES = 1024,
+    SM64_ROM_SIZE = 0x800000, // Size of the US ROM, everything is read at fixed offsets within it
+};
+
+enum
+{
+    // The texture atlas has its color channels multiplied by alpha.
+    SM64_TEXTURE_PREMULTIPLIED_ALPHA = 1 << 0,
+    // The texture atlas is stored as BGRA instead of RGBA.
+    SM64_TEXTURE_BGRA = 1 << 1,
+};
+
+enum SM64TextureFormat
+{
+    SM64_TEXTURE_FORMAT_RGBA8,    // 4 bytes per pixel, BGRA if SM64_TEXTURE_BGRA is set
+    SM64_TEXTURE_FORMAT_RGB565,   // One uint16_t per pixel, red in the top bits (GL_UNSIGNED_SHORT_5_6_5)
+    SM64_TEXTURE_FORMAT_RGBA5551, // One uint16_t per pixel, alpha in the bottom bit (GL_UNSIGNED_SHORT_5_5_5_1)
+    SM64_TEXTURE_FORMAT_BC1,      // 8 bytes per 4x4 block, transparent pixels use the 1 bit alpha mode
+    SM64_TEXTURE_FORMAT_BC3,      // 16 bytes per 4x4 block
+};
+
+enum
+{
+    // Write each unique vertex once and describe the triangles through the index buffer.
+    // The index buffer is only rewritten when Mario's display list configuration changes.
+    SM64_GEO_FLAG_INDEXED = 1 << 0,
+
+    // Only write colors and UVs when the triangles being drawn change, they don't depend on the animation.
+    // The host has to keep the buffer contents between ticks, SM64_GEO_DIRTY_STATIC_ATTRIBUTES tells when to re-upload them.
+    SM64_GEO_FLAG_STATIC_ATTRIBUTES = 1 << 1,
+
+    // Write positions and normals in Mario's local space, scaled but not rotated or moved, and the
+    // rest of his transform to the transform field. Marios in the same pose then share one mesh,
+    // so a crowd can be drawn instanced and the library only transforms each distinct pose once.
+    SM64_GEO_FLAG_LOCAL_SPACE = 1 << 2,
+};
+
+enum
+{
+    SM64_GEO_DIRTY_INDICES = 1 << 0,
+    SM64_GEO_DIRTY_STATIC_ATTRIBUTES = 1 << 1,
+};
+
+// Collision is measured inside the phases that query it, so it overlaps with them. TICK is the
+// whole of sm64_mario_tick.
+enum SM64ProfilePhase
+{
+    SM64_PROFILE_PHASE_PLATFORM_DISPLACEMENT,
+    SM64_PROFILE_PHASE_MARIO_UPDATE,
+    SM64_PROFILE_PHASE_PLATFORM_UPDATE,
+    SM64_PROFILE_PHASE_GEO_PROCESS,
+    SM64_PROFILE_PHASE_COLLISION,
+    SM64_PROFILE_PHASE_TICK,
+    SM64_PROFILE_PHASE_COUNT
+};
+
+// Histogram bucket 0 counts ticks under 1024ns, each following bucket doubles that bound and
+// the last one counts everything slower.
+#define SM64_PROFILE_HISTOGRAM_BUCKETS 16
+
+struct SM64ProfilePhaseStats
+{
+    uint64_t totalNanoseconds;
+    uint64_t minNanoseconds;
+    uint64_t maxNanoseconds;
+    uint32_t samples;
+    uint32_t histogram[SM64_PROFILE_HISTOGRAM_BUCKETS];
+};
+
+struct SM64ProfileStats
+{
+    struct SM64ProfilePhaseStats phases[SM64_PROFILE_PHASE_COUNT];
 };
 
 
@@ -141,9 +232,57 @@ typedef void (*SM64PlaySoundFunctionPtr)( uint32_t soundBits, float *pos );
 extern SM64_LIB_FN void sm64_register_play_sound_function( SM64PlaySoundFunctionPtr playSoundFunction );
 
 extern SM64_LIB_FN void sm64_global_init( const uint8_t *rom, uint8_t *outTexture );
+// SM64_TEXTURE_* flags for the atlas written by the following sm64_global_init* calls, 0 by default.
+extern SM64_LIB_FN void sm64_set_texture_flags( uint32_t flags );
+
+// Writes the texture atlas from the last sm64_global_init* call in the given format, followed by
+// its box filtered mip levels, each half the size of the previous one down to 1x1. mipLevels counts
+// the full size level and is clamped to the full chain, 0 also means the full chain. Levels are
+// tightly packed one after the other, block compressed ones padded up to whole 4x4 blocks. The
+// output only depends on the ROM, flags, format and level count, so it can be cached. Returns the
+// number of bytes written, or the size needed when out is NULL, and 0 before init.
+extern SM64_LIB_FN size_t sm64_texture_atlas_export( enum SM64TextureFormat format, uint32_t mipLevels, uint8_t *out );
 extern SM64_LIB_FN void sm64_global_terminate( void );
 
+// Same as sm64_global_init, but memory-maps the ROM at romPath instead of needing it read into memory.
+// Returns false if the file couldn't be mapped.
+extern SM64_LIB_FN bool sm64_global_init_from_path( const char *romPath, uint8_t *outTexture );
+
+// Same as sm64_global_init, but loads the decoded texture atlas and animations from the file at
+// cachePath when it was written for this ROM. Otherwise they're decoded from the ROM and the file
+// is (re)written. Returns true if the cache was used.
+extern SM64_LIB_FN bool sm64_global_init_cached( const uint8_t *rom, uint8_t *outTexture, const char *cachePath );
+
+enum SM64InitStatus
+{
+    SM64_INIT_NOT_STARTED = 0,
+    SM64_INIT_IN_PROGRESS,
+    SM64_INIT_DONE
+};
+
+// Does the work of sm64_global_init_cached (or sm64_global_init when cachePath is NULL), and of
+// sm64_audio_init when initAudio is set, on a worker thread with the independent stages running in
+// parallel. rom, outTexture and cachePath must stay valid and no other function may be called until
+// sm64_init_poll reports SM64_INIT_DONE. sm64_global_terminate waits for the worker to finish.
+extern SM64_LIB_FN void sm64_global_init_async( const uint8_t *rom, uint8_t *outTexture, const char *cachePath, bool initAudio );
+// Writes the fraction of init stages finished so far to outProgress, if it's not NULL.
+extern SM64_LIB_FN enum SM64InitStatus sm64_init_poll( float *outProgress );
+// Whether the last sm64_global_init_cached or sm64_global_init_async call loaded its assets from the
+// cache file rather than decoding them (and rewriting the file). False until an async init is done.
+extern SM64_LIB_FN bool sm64_init_cache_hit( void );
+
+// Animations are decoded from the ROM the first time they're played. This decodes the rest on a
+// background thread instead, so playing one later never has to wait for it.
+extern SM64_LIB_FN void sm64_prewarm_animations( void );
+
+// Animations are decoded into per-frame part transforms the first time they're played, keeping the
+// most recently used ones within this many bytes. 0, the default, turns the cache off.
+extern SM64_LIB_FN void sm64_set_anim_pose_cache_budget( size_t bytes );
+
 extern SM64_LIB_FN void sm64_audio_init( const uint8_t *rom );
+// Same as sm64_audio_init, but the sound banks and sequences are played straight from the memory-mapped
+// ROM at romPath instead of from a copy. Returns false if the file couldn't be mapped.
+extern SM64_LIB_FN bool sm64_audio_init_from_path( const char *romPath );
 extern SM64_LIB_FN uint32_t sm64_audio_tick( uint32_t numQueuedSamples, uint32_t numDesiredSamples, int16_t *audio_buffer );
 
 extern SM64_LIB_FN void sm64_static_surfaces_load( const struct SM64Surface *surfaceArray, uint32_t numSurfaces );
@@ -152,6 +291,37 @@ extern SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z );
 extern SM64_LIB_FN void sm64_mario_tick( int32_t marioId, const struct SM64MarioInputs *inputs, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers );
 extern SM64_LIB_FN void sm64_mario_delete( int32_t marioId );
 
+// Snapshots hold the whole state of a Mario in a flat buffer of sm64_mario_snapshot_size() bytes,
+// and can be restored into the same or another Mario. They reference the loaded surfaces and
+// animations, so those must not change between saving and loading.
+extern SM64_LIB_FN size_t sm64_mario_snapshot_size( void );
+extern SM64_LIB_FN bool sm64_mario_snapshot_save( int32_t marioId, void *buffer );
+extern SM64_LIB_FN bool sm64_mario_snapshot_load( int32_t marioId, const void *buffer );
+
+// Records every tick and setter call into a stream that sm64_replay_run plays back headless
+// against the same level, reporting the hash of each tick's state and the first one that differs.
+// The stream returned by sm64_replay_record_stop stays valid until recording starts again.
+extern SM64_LIB_FN void sm64_replay_record_start( void );
+extern SM64_LIB_FN const uint8_t *sm64_replay_record_stop( size_t *outSize );
+extern SM64_LIB_FN uint32_t sm64_replay_run( const uint8_t *stream, size_t size, uint32_t *outTickHashes, uint32_t maxTickHashes, int32_t *outFirstMismatch );
+extern SM64_LIB_FN uint32_t sm64_mario_state_hash( const struct SM64MarioState *state );
+
+// Net states are encoded as the quantized difference from a baseline the receiver already has,
+// usually the last state it acknowledged, or from zero when baseline is NULL. Decoding needs the
+// same baseline. Both return the number of bytes written or read, or 0 if the buffer is too small.
+extern SM64_LIB_FN bool sm64_mario_get_net_state( int32_t marioId, struct SM64MarioNetState *outState );
+extern SM64_LIB_FN uint32_t sm64_net_state_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *state, uint8_t *outBuffer, uint32_t bufferSize );
+extern SM64_LIB_FN uint32_t sm64_net_state_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t bufferSize, struct SM64MarioNetState *outState );
+
+// Per phase timings of every tick of a Mario since it was created or last reset. Only available
+// when the library is built with LIBSM64_PROFILE=1, otherwise sm64_profile_get returns false.
+extern SM64_LIB_FN bool sm64_profile_get( int32_t marioId, struct SM64ProfileStats *outStats );
+extern SM64_LIB_FN void sm64_profile_reset( int32_t marioId );
+
+// While deferred, the setters below (except sm64_mario_attack) only queue the change and it's
+// applied in call order at the start of that Mario's next sm64_mario_tick.
+extern SM64_LIB_FN void sm64_set_deferred_setters( bool deferred );
+
 extern SM64_LIB_FN void sm64_set_mario_action(int32_t marioId, uint32_t action);
 extern SM64_LIB_FN void sm64_set_mario_action_arg(int32_t marioId, uint32_t action, uint32_t actionArg);
 extern SM64_LIB_FN void sm64_set_mario_animation(int32_t marioId, int32_t animID);
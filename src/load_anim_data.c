@@ -1,9 +1,71 @@
 #include "load_anim_data.h"
 
 #include <stdlib.h>
-	
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "decomp/include/mario_animation_ids.h"
+
+enum
+{
+    ANIM_UNLOADED,
+    ANIM_LOADING,
+    ANIM_LOADED,
+};
+
 static uint32_t s_num_entries = 0;
 static struct Animation *s_libsm64_mario_animations = NULL;
+static uint8_t *s_anim_states = NULL;
+
+// Every animation's index and values live in this one blob, still big endian as copied from the
+// ROM until the animation is first played or the pre-warm thread gets to it. Each animation starts
+// on a cache line, with the ones played most often packed at the front.
+static uint8_t *s_anim_blob_alloc = NULL;
+
+#define ANIM_BLOB_ALIGNMENT 64
+
+static const uint16_t s_hot_animations[] =
+{
+    MARIO_ANIM_IDLE_HEAD_LEFT,
+    MARIO_ANIM_IDLE_HEAD_RIGHT,
+    MARIO_ANIM_IDLE_HEAD_CENTER,
+    MARIO_ANIM_FIRST_PERSON,
+    MARIO_ANIM_START_TIPTOE,
+    MARIO_ANIM_TIPTOE,
+    MARIO_ANIM_WALKING,
+    MARIO_ANIM_RUNNING,
+    MARIO_ANIM_SKID_ON_GROUND,
+    MARIO_ANIM_STOP_SKID,
+    MARIO_ANIM_TURNING_PART1,
+    MARIO_ANIM_TURNING_PART2,
+    MARIO_ANIM_SINGLE_JUMP,
+    MARIO_ANIM_LAND_FROM_SINGLE_JUMP,
+    MARIO_ANIM_DOUBLE_JUMP_RISE,
+    MARIO_ANIM_DOUBLE_JUMP_FALL,
+    MARIO_ANIM_LAND_FROM_DOUBLE_JUMP,
+    MARIO_ANIM_TRIPLE_JUMP,
+    MARIO_ANIM_TRIPLE_JUMP_LAND,
+    MARIO_ANIM_GENERAL_FALL,
+    MARIO_ANIM_GENERAL_LAND,
+    MARIO_ANIM_START_CROUCHING,
+    MARIO_ANIM_CROUCHING,
+    MARIO_ANIM_STOP_CROUCHING,
+    MARIO_ANIM_FIRST_PUNCH,
+    MARIO_ANIM_SECOND_PUNCH,
+    MARIO_ANIM_GROUND_KICK,
+    MARIO_ANIM_DIVE,
+    MARIO_ANIM_SLIDE_KICK,
+    MARIO_ANIM_FAST_LONGJUMP,
+    MARIO_ANIM_SLOW_LONGJUMP,
+    MARIO_ANIM_BACKFLIP,
+    MARIO_ANIM_START_WALLKICK,
+};
+
+static pthread_t s_prewarm_thread;
+static bool s_prewarm_running = false;
+static int s_prewarm_cancel = 0;
 
 #define ANIM_DATA_ADDRESS 0x004EC000
 
@@ -29,74 +91,281 @@ static uint32_t read_u32_be( const uint8_t *p )
         (uint32_t)p[3];
 }
 
-void load_mario_anims_from_rom( const uint8_t *rom )
+#define GET_OFFSET( data, n ) (read_u32_be((uint8_t*)&((struct OffsetSizePair*)( (data) + 8 + (n)*8 ))->offset))
+
+static void decode_animation( uint32_t i )
 {
-    #define GET_OFFSET( n ) (read_u32_be((uint8_t*)&((struct OffsetSizePair*)( rom + ANIM_DATA_ADDRESS + 8 + (n)*8 ))->offset))
-    #define GET_SIZE(   n ) (read_u32_be((uint8_t*)&((struct OffsetSizePair*)( rom + ANIM_DATA_ADDRESS + 8 + (n)*8 ))->size  ))
+    struct Animation *anim = &s_libsm64_mario_animations[i];
+    uint16_t *data = anim->index;
 
-    const uint8_t *read_ptr = rom + ANIM_DATA_ADDRESS;
-    s_num_entries = read_u32_be( read_ptr );
+    for( uint32_t j = 0; j < anim->length / 2; ++j )
+        data[j] = read_u16_be( (const uint8_t *)&data[j] );
+}
+
+static void ensure_animation_loaded( uint32_t i )
+{
+    uint8_t expected = ANIM_UNLOADED;
+
+    if( __atomic_compare_exchange_n( &s_anim_states[i], &expected, ANIM_LOADING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE ))
+    {
+        decode_animation( i );
+        __atomic_store_n( &s_anim_states[i], ANIM_LOADED, __ATOMIC_RELEASE );
+        return;
+    }
+
+    // The pre-warm thread is decoding this one right now
+    while( __atomic_load_n( &s_anim_states[i], __ATOMIC_ACQUIRE ) != ANIM_LOADED )
+        sched_yield();
+}
+
+static void *prewarm_thread( void *arg )
+{
+    for( uint32_t i = 0; i < s_num_entries && !__atomic_load_n( &s_prewarm_cancel, __ATOMIC_RELAXED ); ++i )
+    {
+        if( __atomic_load_n( &s_anim_states[i], __ATOMIC_ACQUIRE ) == ANIM_UNLOADED )
+            ensure_animation_loaded( i );
+    }
 
-    s_libsm64_mario_animations = malloc( s_num_entries * sizeof( struct Animation ));
+    return NULL;
+}
+
+struct AnimationSource
+{
+    const uint8_t *index;
+    const uint8_t *values;
+    uint32_t values_count;
+};
+
+static void parse_animation_header( const uint8_t *table, uint32_t i, struct Animation *anim, struct AnimationSource *source )
+{
+    const uint8_t *anim_ptr = table + GET_OFFSET( table, i );
+    const uint8_t *read_ptr = anim_ptr;
+
+    anim->flags             = read_s16_be( read_ptr ); read_ptr += 2;
+    anim->animYTransDivisor = read_s16_be( read_ptr ); read_ptr += 2;
+    anim->startFrame        = read_s16_be( read_ptr ); read_ptr += 2;
+    anim->loopStart         = read_s16_be( read_ptr ); read_ptr += 2;
+    anim->loopEnd           = read_s16_be( read_ptr ); read_ptr += 2;
+    anim->unusedBoneCount   = read_s16_be( read_ptr ); read_ptr += 2;
+    uint32_t values_offset = read_u32_be( read_ptr ); read_ptr += 4;
+    uint32_t index_offset  = read_u32_be( read_ptr ); read_ptr += 4;
+    uint32_t end_offset    = read_u32_be( read_ptr );
+
+    source->index = anim_ptr + index_offset;
+    source->values = anim_ptr + values_offset;
+    source->values_count = ( end_offset - values_offset ) / 2;
+
+    anim->indexLength = ( values_offset - index_offset ) / 2;
+    anim->length = ( anim->indexLength + source->values_count ) * sizeof( uint16_t );
+}
+
+void load_mario_anims_from_rom( const uint8_t *rom )
+{
+    const uint8_t *table = rom + ANIM_DATA_ADDRESS;
+    s_num_entries = read_u32_be( table );
+
+    s_libsm64_mario_animations = calloc( s_num_entries, sizeof( struct Animation ));
+    s_anim_states = calloc( s_num_entries, sizeof( uint8_t ));
     struct Animation *anims = s_libsm64_mario_animations;
 
-    for( int i = 0; i < s_num_entries; ++i )
+    struct AnimationSource *sources = malloc( s_num_entries * sizeof( struct AnimationSource ));
+    uint32_t *order = malloc( s_num_entries * sizeof( uint32_t ));
+    bool *placed = calloc( s_num_entries, sizeof( bool ));
+    uint32_t num_ordered = 0;
+
+    // Hot animations first, then everything else in ROM order
+    for( uint32_t k = 0; k < sizeof( s_hot_animations ) / sizeof( s_hot_animations[0] ); ++k )
     {
-        read_ptr = rom + ANIM_DATA_ADDRESS + GET_OFFSET(i);
-
-        anims[i].flags             = read_s16_be( read_ptr ); read_ptr += 2;
-        anims[i].animYTransDivisor = read_s16_be( read_ptr ); read_ptr += 2;
-        anims[i].startFrame        = read_s16_be( read_ptr ); read_ptr += 2;
-        anims[i].loopStart         = read_s16_be( read_ptr ); read_ptr += 2;
-        anims[i].loopEnd           = read_s16_be( read_ptr ); read_ptr += 2;
-        anims[i].unusedBoneCount   = read_s16_be( read_ptr ); read_ptr += 2;
-        uint32_t values_offset = read_u32_be( read_ptr ); read_ptr += 4;
-        uint32_t index_offset  = read_u32_be( read_ptr ); read_ptr += 4;
-        uint32_t end_offset    = read_u32_be( read_ptr );
-
-        read_ptr                  = rom + ANIM_DATA_ADDRESS + GET_OFFSET(i) + index_offset;
-        const uint8_t *values_ptr = rom + ANIM_DATA_ADDRESS + GET_OFFSET(i) + values_offset;
-        const uint8_t *end_ptr    = rom + ANIM_DATA_ADDRESS + GET_OFFSET(i) + end_offset;
-
-        anims[i].index = malloc( values_offset - index_offset );
-        anims[i].values = malloc( end_offset - values_offset );
-
-        int j = 0;
-        while( read_ptr < values_ptr )
+        uint32_t i = s_hot_animations[k];
+        if( i < s_num_entries && !placed[i] )
         {
-            anims[i].index[j++] = read_u16_be( read_ptr );
-            read_ptr += 2;
+            placed[i] = true;
+            order[num_ordered++] = i;
         }
+    }
 
-        j = 0;
-        while( read_ptr < end_ptr )
-        {
-            anims[i].values[j++] = read_u16_be( read_ptr );
-            read_ptr += 2;
-        }
+    for( uint32_t i = 0; i < s_num_entries; ++i )
+    {
+        if( !placed[i] )
+            order[num_ordered++] = i;
     }
 
-    #undef GET_OFFSET
-    #undef GET_SIZE
+    size_t blob_size = 0;
+    for( uint32_t i = 0; i < s_num_entries; ++i )
+    {
+        parse_animation_header( table, i, &anims[i], &sources[i] );
+        blob_size += ( anims[i].length + ANIM_BLOB_ALIGNMENT - 1 ) & ~(size_t)( ANIM_BLOB_ALIGNMENT - 1 );
+    }
+
+    s_anim_blob_alloc = malloc( blob_size + ANIM_BLOB_ALIGNMENT - 1 );
+    uint8_t *blob = (uint8_t *)( ( (uintptr_t)s_anim_blob_alloc + ANIM_BLOB_ALIGNMENT - 1 ) & ~(uintptr_t)( ANIM_BLOB_ALIGNMENT - 1 ));
+
+    for( uint32_t k = 0; k < num_ordered; ++k )
+    {
+        struct Animation *anim = &anims[order[k]];
+        struct AnimationSource *source = &sources[order[k]];
+
+        anim->index = (uint16_t *)blob;
+        anim->values = (int16_t *)( anim->index + anim->indexLength );
+        memcpy( anim->index, source->index, anim->indexLength * sizeof( uint16_t ));
+        memcpy( anim->values, source->values, source->values_count * sizeof( int16_t ));
+
+        blob += ( anim->length + ANIM_BLOB_ALIGNMENT - 1 ) & ~(size_t)( ANIM_BLOB_ALIGNMENT - 1 );
+    }
+
+    free( placed );
+    free( order );
+    free( sources );
+}
+
+// Layout of the animations in an asset cache file: the table below, then the decoded blob starting
+// on the next ANIM_BLOB_ALIGNMENT boundary with every offset relative to it.
+struct AnimCacheEntry
+{
+    int16_t flags;
+    int16_t animYTransDivisor;
+    int16_t startFrame;
+    int16_t loopStart;
+    int16_t loopEnd;
+    int16_t unusedBoneCount;
+    uint32_t indexLength;
+    uint32_t length;
+    uint32_t offset;
+};
+
+static size_t anim_cache_blob_start( uint32_t num_entries )
+{
+    size_t table_size = sizeof( uint32_t ) + num_entries * sizeof( struct AnimCacheEntry );
+    return ( table_size + ANIM_BLOB_ALIGNMENT - 1 ) & ~(size_t)( ANIM_BLOB_ALIGNMENT - 1 );
+}
+
+size_t save_mario_anims( uint8_t *out )
+{
+    uint8_t *blob = (uint8_t *)( ( (uintptr_t)s_anim_blob_alloc + ANIM_BLOB_ALIGNMENT - 1 ) & ~(uintptr_t)( ANIM_BLOB_ALIGNMENT - 1 ));
+    size_t blob_start = anim_cache_blob_start( s_num_entries );
+    size_t size = blob_start;
+
+    for( uint32_t i = 0; i < s_num_entries; ++i )
+    {
+        size_t end = (size_t)( (uint8_t *)s_libsm64_mario_animations[i].index - blob ) + s_libsm64_mario_animations[i].length;
+        if( blob_start + end > size )
+            size = blob_start + end;
+    }
+
+    if( out == NULL )
+        return size;
+
+    memset( out, 0, blob_start );
+    memcpy( out, &s_num_entries, sizeof( uint32_t ));
+    struct AnimCacheEntry *entries = (struct AnimCacheEntry *)( out + sizeof( uint32_t ));
+
+    for( uint32_t i = 0; i < s_num_entries; ++i )
+    {
+        struct Animation *anim = &s_libsm64_mario_animations[i];
+
+        if( __atomic_load_n( &s_anim_states[i], __ATOMIC_ACQUIRE ) != ANIM_LOADED )
+            ensure_animation_loaded( i );
+
+        entries[i].flags = anim->flags;
+        entries[i].animYTransDivisor = anim->animYTransDivisor;
+        entries[i].startFrame = anim->startFrame;
+        entries[i].loopStart = anim->loopStart;
+        entries[i].loopEnd = anim->loopEnd;
+        entries[i].unusedBoneCount = anim->unusedBoneCount;
+        entries[i].indexLength = anim->indexLength;
+        entries[i].length = anim->length;
+        entries[i].offset = (uint32_t)( (uint8_t *)anim->index - blob );
+
+        memcpy( out + blob_start + entries[i].offset, anim->index, anim->length );
+    }
+
+    return size;
+}
+
+bool load_mario_anims_from_cache( const uint8_t *data, size_t size )
+{
+    uint32_t num_entries;
+    if( size < sizeof( uint32_t ))
+        return false;
+
+    // Checked before anim_cache_blob_start so its multiply can't wrap on 32 bit builds
+    memcpy( &num_entries, data, sizeof( uint32_t ));
+    if( num_entries > ( size - sizeof( uint32_t )) / sizeof( struct AnimCacheEntry ))
+        return false;
+
+    size_t blob_start = anim_cache_blob_start( num_entries );
+    if( blob_start > size )
+        return false;
+
+    // Entries are aligned like in the blob, and the values follow the index inside each entry's bytes
+    const struct AnimCacheEntry *entries = (const struct AnimCacheEntry *)( data + sizeof( uint32_t ));
+    for( uint32_t i = 0; i < num_entries; ++i )
+    {
+        if( entries[i].offset % ANIM_BLOB_ALIGNMENT != 0 ||
+            entries[i].offset > size - blob_start ||
+            entries[i].length > size - blob_start - entries[i].offset ||
+            entries[i].indexLength > entries[i].length / sizeof( uint16_t ))
+            return false;
+    }
+
+    s_num_entries = num_entries;
+    s_libsm64_mario_animations = calloc( s_num_entries, sizeof( struct Animation ));
+    s_anim_states = malloc( s_num_entries * sizeof( uint8_t ));
+    memset( s_anim_states, ANIM_LOADED, s_num_entries * sizeof( uint8_t ));
+
+    // The blob stays in the caller's mapping, nothing to decode or free
+    for( uint32_t i = 0; i < s_num_entries; ++i )
+    {
+        struct Animation *anim = &s_libsm64_mario_animations[i];
+
+        anim->flags = entries[i].flags;
+        anim->animYTransDivisor = entries[i].animYTransDivisor;
+        anim->startFrame = entries[i].startFrame;
+        anim->loopStart = entries[i].loopStart;
+        anim->loopEnd = entries[i].loopEnd;
+        anim->unusedBoneCount = entries[i].unusedBoneCount;
+        anim->indexLength = entries[i].indexLength;
+        anim->length = entries[i].length;
+        anim->index = (uint16_t *)( data + blob_start + entries[i].offset );
+        anim->values = (int16_t *)( anim->index + anim->indexLength );
+    }
+
+    return true;
+}
+
+void prewarm_mario_anims( void )
+{
+    if( s_prewarm_running || s_num_entries == 0 )
+        return;
+
+    s_prewarm_cancel = 0;
+    s_prewarm_running = pthread_create( &s_prewarm_thread, NULL, prewarm_thread, NULL ) == 0;
 }
 
 void load_mario_animation(struct MarioAnimation *a, u32 index)
 {
     if (a->currentAnimAddr != 1 + index) {
         a->currentAnimAddr = 1 + index;
+        if( __atomic_load_n( &s_anim_states[index], __ATOMIC_ACQUIRE ) != ANIM_LOADED )
+            ensure_animation_loaded( index );
         a->targetAnim = &s_libsm64_mario_animations[index];
     }
 }
 
 void unload_mario_anims( void )
 {
-    for( int i = 0; i < s_num_entries; ++i )
+    if( s_prewarm_running )
     {
-        free( s_libsm64_mario_animations[i].index );
-        free( s_libsm64_mario_animations[i].values );
+        __atomic_store_n( &s_prewarm_cancel, 1, __ATOMIC_RELAXED );
+        pthread_join( s_prewarm_thread, NULL );
+        s_prewarm_running = false;
     }
 
     free( s_libsm64_mario_animations );
+    free( s_anim_states );
+    free( s_anim_blob_alloc );
     s_libsm64_mario_animations = NULL;
+    s_anim_states = NULL;
+    s_anim_blob_alloc = NULL;
     s_num_entries = 0;
-}
+}
\ No newline at end of file
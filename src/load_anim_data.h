@@ -2,9 +2,13 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #include "decomp/include/types.h"
 
 extern void load_mario_animation(struct MarioAnimation *a, u32 index);
 extern void load_mario_anims_from_rom( const uint8_t *rom );
+extern void prewarm_mario_anims( void );
+extern size_t save_mario_anims( uint8_t *out );
+extern bool load_mario_anims_from_cache( const uint8_t *data, size_t size );
 extern void unload_mario_anims( void );
\ No newline at end of file
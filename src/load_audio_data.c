@@ -1,24 +1,55 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "load_audio_data.h"
 
 #include "decomp/tools/convUtils.h"
+#include "decomp/tools/utils.h"
 #include "decomp/audio/load.h"
 #include "decomp/audio/load_dat.h"
 #include "decomp/audio/external.h"
+#include "file_map.h"
+
+#define AUDIO_CTL_ADDRESS 0x57B720
+#define AUDIO_TBL_ADDRESS 0x593560
+#define AUDIO_SEQ_ADDRESS 0x7B0860
+#define AUDIO_BANK_SETS_ADDRESS 0x7CC621
+#define AUDIO_BANK_SETS_SIZE 0x100
 
 bool g_is_audio_initialized = false;
 
-extern void load_audio_banks( const uint8_t *rom ) {
-    // FIXME: rom_copy purposfully leaks here
-    uint8_t *rom_copy = malloc( 0x800000 );
+// The sample and sequence tables point straight into ROM data for as long as audio runs: either the
+// mapped ROM or a copy of just the range they cover. The CTL is parsed into its own buffer, and
+// the bank sets are the only bytes patched in place so they get their own small copy.
+static struct FileMap s_rom_map;
+static uint8_t *s_audio_data = NULL;
+static uint8_t s_bank_sets[AUDIO_BANK_SETS_SIZE];
+
+// Offset of the end of the last entry of a sequence file, relative to the ROM
+static uint32_t seqfile_end( const uint8_t *rom, uint32_t address )
+{
+    const uint8_t *seq = rom + address;
+    uint16_t count = read_u16_be( seq + 2 );
+    uint32_t end = address;
+
+    for( uint16_t i = 0; i < count; ++i )
+    {
+        uint32_t entry_end = address + read_u32_be( seq + 4 + i * 8 ) + read_u32_be( seq + 4 + i * 8 + 4 );
+        if( entry_end > end )
+            end = entry_end;
+    }
 
-    memcpy( rom_copy, rom, 0x800000 );
+    return end;
+}
+
+// rom is only read during init, tbl and seq have to stay valid for as long as audio runs
+static void init_audio_from( const uint8_t *rom, uint8_t *tbl, uint8_t *seq ) {
+    gSoundDataADSR = parse_seqfile( (uint8_t *)rom+AUDIO_CTL_ADDRESS ); //ctl
+    gSoundDataRaw = parse_seqfile( tbl ); //tbl
+    gMusicData = parse_seqfile( seq );
 
-    gSoundDataADSR = parse_seqfile( rom_copy+0x57B720 ); //ctl
-    gSoundDataRaw = parse_seqfile( rom_copy+0x593560 ); //tbl
-    gMusicData = parse_seqfile( rom_copy+0x7B0860 );
-    gBankSetsData = rom_copy+0x7CC621;
+    memcpy( s_bank_sets, rom+AUDIO_BANK_SETS_ADDRESS, AUDIO_BANK_SETS_SIZE );
+    gBankSetsData = s_bank_sets;
     memmove( gBankSetsData+0x45,gBankSetsData+0x45-1,0x5B );
     gBankSetsData[0x45]=0x00;
     ptrs_to_offsets( gSoundDataADSR );
@@ -29,3 +60,41 @@ extern void load_audio_banks( const uint8_t *rom ) {
 
     g_is_audio_initialized = true;
 }
+
+extern void load_audio_banks( const uint8_t *rom ) {
+    uint32_t tbl_end = seqfile_end( rom, AUDIO_TBL_ADDRESS );
+    uint32_t seq_end = seqfile_end( rom, AUDIO_SEQ_ADDRESS );
+    uint32_t end = tbl_end > seq_end ? tbl_end : seq_end;
+
+    // The caller may free rom once this returns, so keep the range the tables point into
+    file_map_close( &s_rom_map );
+    free( s_audio_data );
+    s_audio_data = malloc( end - AUDIO_TBL_ADDRESS );
+    memcpy( s_audio_data, rom+AUDIO_TBL_ADDRESS, end - AUDIO_TBL_ADDRESS );
+
+    init_audio_from( rom, s_audio_data, s_audio_data + ( AUDIO_SEQ_ADDRESS - AUDIO_TBL_ADDRESS ));
+}
+
+extern bool load_audio_banks_from_path( const char *romPath ) {
+    struct FileMap map;
+    if( !file_map_open( &map, romPath ))
+        return false;
+
+    if( map.size < AUDIO_BANK_SETS_ADDRESS + AUDIO_BANK_SETS_SIZE ||
+        seqfile_end( map.data, AUDIO_TBL_ADDRESS ) > map.size ||
+        seqfile_end( map.data, AUDIO_SEQ_ADDRESS ) > map.size )
+    {
+        file_map_close( &map );
+        return false;
+    }
+
+    // Nothing is ever written through the tables, so the read-only mapping is used as is
+    file_map_close( &s_rom_map );
+    free( s_audio_data );
+    s_audio_data = NULL;
+    s_rom_map = map;
+
+    uint8_t *rom = (uint8_t *)s_rom_map.data;
+    init_audio_from( rom, rom+AUDIO_TBL_ADDRESS, rom+AUDIO_SEQ_ADDRESS );
+    return true;
+}
\ No newline at end of file
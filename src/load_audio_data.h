@@ -5,4 +5,5 @@
 
 extern bool g_is_audio_initialized;
 
-extern void load_audio_banks( const uint8_t *rom );
\ No newline at end of file
+extern void load_audio_banks( const uint8_t *rom );
+extern bool load_audio_banks_from_path( const char *romPath );
\ No newline at end of file
@@ -6,27 +6,96 @@
 #include "libsm64.h"
 
 #include "decomp/tools/libmio0.h"
-#include "decomp/tools/n64graphics.h"
 
-#define MARIO_TEX_ROM_OFFSET 1132368
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
 #define ATLAS_WIDTH (NUM_USED_TEXTURES * 64)
 #define ATLAS_HEIGHT 64
 
-static void blt_image_to_atlas( rgba *img, int i, int w, int h, uint8_t *outTexture )
+// Same as SCALE_5_8 in n64graphics.c, (x * 255) / 31, but with a multiply and a shift that stay
+// exact and within 16 bits for every 5 bit value.
+#define SCALE_5_8( x ) ( ( (x) * 1053 ) >> 7 )
+
+static void decode_rgba5551_scalar( const uint8_t *raw, uint8_t *out, int count, uint32_t flags )
 {
-    for( int iy = 0; iy < h; ++iy )
-    for( int ix = 0; ix < w; ++ix )
+    int r_index = ( flags & SM64_TEXTURE_BGRA ) ? 2 : 0;
+    int b_index = 2 - r_index;
+
+    for( int i = 0; i < count; ++i, raw += 2, out += 4 )
     {
-        int o = (ix + 64 * i) + iy * ATLAS_WIDTH;
-        int q = ix + iy * w;
-        outTexture[4*o + 0] = img[q].red;
-        outTexture[4*o + 1] = img[q].green;
-        outTexture[4*o + 2] = img[q].blue;
-        outTexture[4*o + 3] = img[q].alpha;
+        uint16_t v = (uint16_t)( raw[0] << 8 | raw[1] );
+        uint8_t a = ( v & 1 ) ? 0xFF : 0x00;
+        uint8_t mask = ( flags & SM64_TEXTURE_PREMULTIPLIED_ALPHA ) ? a : 0xFF;
+
+        out[r_index] = SCALE_5_8( v >> 11 ) & mask;
+        out[1]       = SCALE_5_8( ( v >> 6 ) & 0x1F ) & mask;
+        out[b_index] = SCALE_5_8( ( v >> 1 ) & 0x1F ) & mask;
+        out[3]       = a;
     }
 }
 
-void load_mario_textures_from_rom( const uint8_t *rom, uint8_t *outTexture )
+#ifdef __SSE2__
+
+// Decodes 8 pixels per iteration with each channel in its own 16 bit lane, then packs the
+// channels back into bytes. Alpha is a single bit, so premultiplying is just masking with it.
+static void decode_rgba5551_sse2( const uint8_t *raw, uint8_t *out, int count, uint32_t flags )
+{
+    const __m128i five_bits = _mm_set1_epi16( 0x1F );
+    const __m128i scale = _mm_set1_epi16( 1053 );
+    const __m128i one = _mm_set1_epi16( 1 );
+    const __m128i byte = _mm_set1_epi16( 0xFF );
+    const bool bgra = flags & SM64_TEXTURE_BGRA;
+    const bool premultiply = flags & SM64_TEXTURE_PREMULTIPLIED_ALPHA;
+
+    int i = 0;
+    for( ; i + 8 <= count; i += 8, raw += 16, out += 32 )
+    {
+        __m128i v = _mm_loadu_si128( (const __m128i *)raw );
+        v = _mm_or_si128( _mm_slli_epi16( v, 8 ), _mm_srli_epi16( v, 8 ));
+
+        __m128i r = _mm_srli_epi16( _mm_mullo_epi16( _mm_srli_epi16( v, 11 ), scale ), 7 );
+        __m128i g = _mm_srli_epi16( _mm_mullo_epi16( _mm_and_si128( _mm_srli_epi16( v, 6 ), five_bits ), scale ), 7 );
+        __m128i b = _mm_srli_epi16( _mm_mullo_epi16( _mm_and_si128( _mm_srli_epi16( v, 1 ), five_bits ), scale ), 7 );
+        __m128i opaque = _mm_cmpeq_epi16( _mm_and_si128( v, one ), one );
+        __m128i a = _mm_and_si128( opaque, byte );
+
+        if( premultiply )
+        {
+            r = _mm_and_si128( r, opaque );
+            g = _mm_and_si128( g, opaque );
+            b = _mm_and_si128( b, opaque );
+        }
+
+        if( bgra )
+        {
+            __m128i t = r;
+            r = b;
+            b = t;
+        }
+
+        __m128i rg = _mm_or_si128( r, _mm_slli_epi16( g, 8 ));
+        __m128i ba = _mm_or_si128( b, _mm_slli_epi16( a, 8 ));
+        _mm_storeu_si128( (__m128i *)out, _mm_unpacklo_epi16( rg, ba ));
+        _mm_storeu_si128( (__m128i *)( out + 16 ), _mm_unpackhi_epi16( rg, ba ));
+    }
+
+    decode_rgba5551_scalar( raw, out, count - i, flags );
+}
+
+#endif
+
+void decode_rgba5551( const uint8_t *raw, uint8_t *out, int count, uint32_t flags )
+{
+#ifdef __SSE2__
+    decode_rgba5551_sse2( raw, out, count, flags );
+#else
+    decode_rgba5551_scalar( raw, out, count, flags );
+#endif
+}
+
+void load_mario_textures_from_rom( const uint8_t *rom, uint8_t *outTexture, uint32_t flags )
 {
     memset( outTexture, 0, 4 * ATLAS_WIDTH * ATLAS_HEIGHT );
 
@@ -35,14 +104,16 @@ void load_mario_textures_from_rom( const uint8_t *rom, uint8_t *outTexture )
 
     mio0_decode_header( in_buf, &head );
     uint8_t *out_buf = malloc( head.dest_size );
-    mio0_decode( in_buf, out_buf, NULL );
+    mio0_decode_fast( in_buf, out_buf, NULL );
 
+    // Each row is decoded straight into its place in the atlas
     for( int i = 0; i < NUM_USED_TEXTURES; ++i )
     {
-        uint8_t *raw = out_buf + mario_tex_offsets[i];
-        rgba *img = raw2rgba( raw, mario_tex_widths[i], mario_tex_heights[i], 16 );
-        blt_image_to_atlas( img, i, mario_tex_widths[i], mario_tex_heights[i], outTexture );
-        free( img );
+        const uint8_t *raw = out_buf + mario_tex_offsets[i];
+        int w = mario_tex_widths[i];
+
+        for( int iy = 0; iy < mario_tex_heights[i]; ++iy )
+            decode_rgba5551( raw + 2 * w * iy, outTexture + 4 * ( 64 * i + iy * ATLAS_WIDTH ), w, flags );
     }
 
     free( out_buf );
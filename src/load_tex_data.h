@@ -25,10 +25,13 @@ enum MarioTextures
     mario_texture_eyes_down
 };
 
+#define MARIO_TEX_ROM_OFFSET 1132368
 #define NUM_USED_TEXTURES 11
 
 static const int mario_tex_offsets[NUM_USED_TEXTURES] = { 144, 4240, 6288, 8336, 10384, 12432, 14480, 16528, 30864, 32912, 37008 };
 static const int mario_tex_widths [NUM_USED_TEXTURES] = { 64, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32 };
 static const int mario_tex_heights[NUM_USED_TEXTURES] = { 32, 32, 32, 32, 32, 32, 32, 32, 32, 64, 64 };
 
-extern void load_mario_textures_from_rom( const uint8_t *rom, uint8_t *outTexture );
\ No newline at end of file
+// Decodes count big endian RGBA5551 pixels to 8 bits per channel, with SM64_TEXTURE_* flags
+extern void decode_rgba5551( const uint8_t *raw, uint8_t *out, int count, uint32_t flags );
+extern void load_mario_textures_from_rom( const uint8_t *rom, uint8_t *outTexture, uint32_t flags );
\ No newline at end of file
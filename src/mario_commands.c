@@ -0,0 +1,26 @@
+#include "mario_commands.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void mario_command_buffer_push( struct MarioCommandBuffer *buffer, enum ReplayOp op, const union ReplayArg *args, uint32_t numArgs )
+{
+    if( buffer->count == buffer->capacity )
+    {
+        buffer->capacity = buffer->capacity > 0 ? 2 * buffer->capacity : 8;
+        buffer->commands = realloc( buffer->commands, buffer->capacity * sizeof( struct MarioCommand ));
+    }
+
+    struct MarioCommand *command = &buffer->commands[buffer->count++];
+    command->op = (uint8_t)op;
+    command->numArgs = (uint8_t)numArgs;
+    memcpy( command->args, args, numArgs * sizeof( union ReplayArg ));
+}
+
+void mario_command_buffer_free( struct MarioCommandBuffer *buffer )
+{
+    free( buffer->commands );
+    buffer->commands = NULL;
+    buffer->count = 0;
+    buffer->capacity = 0;
+}
\ No newline at end of file
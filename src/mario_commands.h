@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "replay.h"
+
+#define MARIO_COMMAND_MAX_ARGS 5
+
+// A setter call waiting for the next tick of its Mario, stored the same way replays store them
+struct MarioCommand
+{
+    uint8_t op;
+    uint8_t numArgs;
+    union ReplayArg args[MARIO_COMMAND_MAX_ARGS];
+};
+
+struct MarioCommandBuffer
+{
+    struct MarioCommand *commands;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+extern void mario_command_buffer_push( struct MarioCommandBuffer *buffer, enum ReplayOp op, const union ReplayArg *args, uint32_t numArgs );
+extern void mario_command_buffer_free( struct MarioCommandBuffer *buffer );
\ No newline at end of file
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "decomp/include/types.h"
+#include "decomp/global_state.h"
+#include "decomp/game/area.h"
+
+// Everything one Mario owns lives in a single cache line aligned slab from the instance pool,
+// with the state touched every tick first so it's packed into as few lines as possible.
+struct MarioInstance
+{
+    struct GlobalState globalState;
+    struct Object marioObject;
+    struct Area area;
+    struct Camera camera;
+};
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "mario_snapshot.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * A snapshot is a header followed by a straight copy of the MarioInstance slab. The only thing
+ * that can't be copied as is are the pointers from one part of the slab to another (MarioState
+ * to the Object, the Area to its Camera...), these get stored as offsets from the start of the
+ * slab so a snapshot can be loaded into any Mario. Pointers that leave the slab (surfaces,
+ * animations) are kept as is, so whatever they point to has to outlive the snapshot.
+ */
+
+#define SNAPSHOT_MAGIC 0x4D534E50 // "MSNP"
+
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t instanceSize;
+    uint64_t relocatedMask; // Bit i is set when s_relocations[i] was stored as an offset
+};
+
+#define INSTANCE_FIELD( field ) offsetof( struct MarioInstance, field )
+
+// Every pointer in the slab that can point back into it
+static const size_t s_relocations[] = {
+    INSTANCE_FIELD( globalState.mgCurrentArea ),
+    INSTANCE_FIELD( globalState.mgCurrentObject ),
+    INSTANCE_FIELD( globalState.mgMarioObject ),
+    INSTANCE_FIELD( globalState.mgMarioSpawnInfoVal.unk18 ),
+    INSTANCE_FIELD( globalState.mgMarioSpawnInfoVal.next ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.interactObj ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.heldObj ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.usedObj ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.riddenObj ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.marioObj ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.spawnInfo ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.area ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.marioBodyState ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.controller ),
+    INSTANCE_FIELD( globalState.mgMarioStateVal.animation ),
+    INSTANCE_FIELD( marioObject.header.gfx.node.prev ),
+    INSTANCE_FIELD( marioObject.header.gfx.node.next ),
+    INSTANCE_FIELD( marioObject.header.gfx.node.parent ),
+    INSTANCE_FIELD( marioObject.header.gfx.node.children ),
+    INSTANCE_FIELD( marioObject.header.gfx.sharedChild ),
+    INSTANCE_FIELD( marioObject.header.gfx.unk4C ),
+    INSTANCE_FIELD( marioObject.header.gfx.throwMatrix ),
+    INSTANCE_FIELD( marioObject.header.next ),
+    INSTANCE_FIELD( marioObject.header.prev ),
+    INSTANCE_FIELD( marioObject.parentObj ),
+    INSTANCE_FIELD( marioObject.prevObj ),
+    INSTANCE_FIELD( marioObject.collidedObjs[0] ),
+    INSTANCE_FIELD( marioObject.collidedObjs[1] ),
+    INSTANCE_FIELD( marioObject.collidedObjs[2] ),
+    INSTANCE_FIELD( marioObject.collidedObjs[3] ),
+    INSTANCE_FIELD( area.objectSpawnInfos ),
+    INSTANCE_FIELD( area.camera ),
+};
+
+#define NUM_RELOCATIONS ( sizeof( s_relocations ) / sizeof( s_relocations[0] ))
+
+_Static_assert( NUM_RELOCATIONS <= 64, "Snapshot relocation mask is too small" );
+
+size_t mario_snapshot_size( void )
+{
+    return sizeof( struct SnapshotHeader ) + sizeof( struct MarioInstance );
+}
+
+void mario_snapshot_save( const struct MarioInstance *instance, void *buffer )
+{
+    struct SnapshotHeader header;
+    uint8_t *slab = (uint8_t *)buffer + sizeof( struct SnapshotHeader );
+    uintptr_t base = (uintptr_t)instance;
+
+    memcpy( slab, instance, sizeof( struct MarioInstance ));
+
+    header.magic = SNAPSHOT_MAGIC;
+    header.instanceSize = sizeof( struct MarioInstance );
+    header.relocatedMask = 0;
+
+    for( uint32_t i = 0; i < NUM_RELOCATIONS; ++i )
+    {
+        uintptr_t ptr;
+        memcpy( &ptr, slab + s_relocations[i], sizeof( uintptr_t ));
+
+        if( ptr >= base && ptr < base + sizeof( struct MarioInstance ))
+        {
+            ptr -= base;
+            memcpy( slab + s_relocations[i], &ptr, sizeof( uintptr_t ));
+            header.relocatedMask |= (uint64_t)1 << i;
+        }
+    }
+
+    memcpy( buffer, &header, sizeof( struct SnapshotHeader ));
+}
+
+bool mario_snapshot_load( struct MarioInstance *instance, const void *buffer )
+{
+    struct SnapshotHeader header;
+    memcpy( &header, buffer, sizeof( struct SnapshotHeader ));
+
+    if( header.magic != SNAPSHOT_MAGIC || header.instanceSize != sizeof( struct MarioInstance ))
+        return false;
+
+    uint8_t *slab = (uint8_t *)instance;
+    uintptr_t base = (uintptr_t)instance;
+
+    memcpy( slab, (const uint8_t *)buffer + sizeof( struct SnapshotHeader ), sizeof( struct MarioInstance ));
+
+    for( uint32_t i = 0; i < NUM_RELOCATIONS; ++i )
+    {
+        if( !( header.relocatedMask & ( (uint64_t)1 << i )))
+            continue;
+
+        uintptr_t ptr;
+        memcpy( &ptr, slab + s_relocations[i], sizeof( uintptr_t ));
+        ptr += base;
+        memcpy( slab + s_relocations[i], &ptr, sizeof( uintptr_t ));
+    }
+
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "mario_instance.h"
+
+extern size_t mario_snapshot_size( void );
+extern void mario_snapshot_save( const struct MarioInstance *instance, void *buffer );
+extern bool mario_snapshot_load( struct MarioInstance *instance, const void *buffer );
\ No newline at end of file
@@ -0,0 +1,232 @@
+#include "net_state.h"
+
+#include <string.h>
+#include <math.h>
+
+#include "decomp/include/types.h"
+
+/**
+ * Every field is quantized to an integer first: positions to 1/8 of a unit, velocities to 1/64,
+ * the face angle back to the s16 it came from. Encoding then writes a varint bitmask of the fields
+ * that differ from the baseline followed by each of those fields as a zigzag varint of the
+ * difference, except the action, which is written as is, and the flags, which are xored with the
+ * baseline's. The baseline goes through the same quantization on both ends, so the decoded state
+ * is exactly the quantized state that was encoded whatever the baseline was.
+ */
+
+#define POSITION_SCALE 8.0f
+#define VELOCITY_SCALE 64.0f
+#define ANGLE_SCALE ( 32768.0f / 3.14159f ) // Inverse of what sm64_mario_tick applies to faceAngle
+
+enum NetField
+{
+    NET_FIELD_POS_X,
+    NET_FIELD_POS_Y,
+    NET_FIELD_POS_Z,
+    NET_FIELD_VEL_X,
+    NET_FIELD_VEL_Y,
+    NET_FIELD_VEL_Z,
+    NET_FIELD_FACE_ANGLE,
+    NET_FIELD_HEALTH,
+    NET_FIELD_ACTION,
+    NET_FIELD_FLAGS,
+    NET_FIELD_ANIM_ID,
+    NET_FIELD_ANIM_FRAME,
+    NET_FIELD_COUNT
+};
+
+static int32_t quantize( float value, float scale )
+{
+    float scaled = value * scale;
+
+    if( !( scaled > -2147483520.0f )) return INT32_MIN + 128; // Also catches NaN
+    if( scaled > 2147483520.0f ) return INT32_MAX - 127;
+
+    return (int32_t)lroundf( scaled );
+}
+
+static void quantize_state( const struct SM64MarioNetState *state, uint32_t *q )
+{
+    if( state == NULL )
+    {
+        memset( q, 0, NET_FIELD_COUNT * sizeof( uint32_t ));
+        return;
+    }
+
+    for( int i = 0; i < 3; ++i )
+    {
+        q[NET_FIELD_POS_X + i] = (uint32_t)quantize( state->position[i], POSITION_SCALE );
+        q[NET_FIELD_VEL_X + i] = (uint32_t)quantize( state->velocity[i], VELOCITY_SCALE );
+    }
+    q[NET_FIELD_FACE_ANGLE] = (uint16_t)(int16_t)quantize( state->faceAngle, ANGLE_SCALE );
+    q[NET_FIELD_HEALTH] = (uint16_t)state->health;
+    q[NET_FIELD_ACTION] = state->action;
+    q[NET_FIELD_FLAGS] = state->flags;
+    q[NET_FIELD_ANIM_ID] = (uint16_t)state->animID;
+    q[NET_FIELD_ANIM_FRAME] = (uint16_t)state->animFrame;
+}
+
+static void dequantize_state( const uint32_t *q, struct SM64MarioNetState *outState )
+{
+    for( int i = 0; i < 3; ++i )
+    {
+        outState->position[i] = (float)(int32_t)q[NET_FIELD_POS_X + i] / POSITION_SCALE;
+        outState->velocity[i] = (float)(int32_t)q[NET_FIELD_VEL_X + i] / VELOCITY_SCALE;
+    }
+    outState->faceAngle = (float)(int16_t)q[NET_FIELD_FACE_ANGLE] / 32768.0f * 3.14159f;
+    outState->health = (int16_t)q[NET_FIELD_HEALTH];
+    outState->action = q[NET_FIELD_ACTION];
+    outState->flags = q[NET_FIELD_FLAGS];
+    outState->animID = (int16_t)q[NET_FIELD_ANIM_ID];
+    outState->animFrame = (int16_t)q[NET_FIELD_ANIM_FRAME];
+}
+
+// The 16 bit fields wrap around so a step from 0x7FFF to -0x8000 stays small
+static uint32_t field_delta( enum NetField field, uint32_t value, uint32_t baseline )
+{
+    switch( field )
+    {
+        case NET_FIELD_ACTION: return value;
+        case NET_FIELD_FLAGS:  return value ^ baseline;
+        case NET_FIELD_FACE_ANGLE:
+        case NET_FIELD_HEALTH:
+        case NET_FIELD_ANIM_ID:
+        case NET_FIELD_ANIM_FRAME:
+        {
+            int32_t delta = (int16_t)( value - baseline );
+            return ( (uint32_t)delta << 1 ) ^ (uint32_t)( delta >> 31 );
+        }
+        default:
+        {
+            int32_t delta = (int32_t)( value - baseline );
+            return ( (uint32_t)delta << 1 ) ^ (uint32_t)( delta >> 31 );
+        }
+    }
+}
+
+static uint32_t field_apply( enum NetField field, uint32_t encoded, uint32_t baseline )
+{
+    switch( field )
+    {
+        case NET_FIELD_ACTION: return encoded;
+        case NET_FIELD_FLAGS:  return encoded ^ baseline;
+        case NET_FIELD_FACE_ANGLE:
+        case NET_FIELD_HEALTH:
+        case NET_FIELD_ANIM_ID:
+        case NET_FIELD_ANIM_FRAME:
+            return (uint16_t)( baseline + ( ( encoded >> 1 ) ^ -( encoded & 1 )));
+        default:
+            return baseline + ( ( encoded >> 1 ) ^ -( encoded & 1 ));
+    }
+}
+
+static bool write_varint( uint8_t *buffer, uint32_t bufferSize, uint32_t *pos, uint32_t value )
+{
+    do
+    {
+        if( *pos >= bufferSize )
+            return false;
+
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buffer[(*pos)++] = byte | ( value ? 0x80 : 0 );
+    }
+    while( value );
+
+    return true;
+}
+
+static bool read_varint( const uint8_t *buffer, uint32_t bufferSize, uint32_t *pos, uint32_t *outValue )
+{
+    uint32_t value = 0;
+
+    for( int shift = 0; shift < 35; shift += 7 )
+    {
+        if( *pos >= bufferSize )
+            return false;
+
+        uint8_t byte = buffer[(*pos)++];
+        value |= (uint32_t)( byte & 0x7F ) << shift;
+
+        if( !( byte & 0x80 ))
+        {
+            *outValue = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void net_state_from_mario( const struct MarioState *m, struct SM64MarioNetState *outState )
+{
+    const struct AnimInfo *animInfo = &m->marioObj->header.gfx.animInfo;
+
+    for( int i = 0; i < 3; ++i )
+    {
+        outState->position[i] = m->pos[i];
+        outState->velocity[i] = m->vel[i];
+    }
+    outState->faceAngle = (float)m->faceAngle[1] / 32768.0f * 3.14159f;
+    outState->health = m->health;
+    outState->action = m->action;
+    outState->flags = m->flags;
+    outState->animID = animInfo->animID;
+    outState->animFrame = animInfo->animFrame;
+}
+
+uint32_t net_state_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *state, uint8_t *outBuffer, uint32_t bufferSize )
+{
+    uint32_t qBaseline[NET_FIELD_COUNT];
+    uint32_t qState[NET_FIELD_COUNT];
+    uint32_t changedMask = 0;
+    uint32_t pos = 0;
+
+    quantize_state( baseline, qBaseline );
+    quantize_state( state, qState );
+
+    for( int i = 0; i < NET_FIELD_COUNT; ++i )
+        if( qState[i] != qBaseline[i] )
+            changedMask |= 1u << i;
+
+    if( !write_varint( outBuffer, bufferSize, &pos, changedMask ))
+        return 0;
+
+    for( int i = 0; i < NET_FIELD_COUNT; ++i )
+    {
+        if( !( changedMask & ( 1u << i )))
+            continue;
+
+        if( !write_varint( outBuffer, bufferSize, &pos, field_delta( i, qState[i], qBaseline[i] )))
+            return 0;
+    }
+
+    return pos;
+}
+
+uint32_t net_state_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t bufferSize, struct SM64MarioNetState *outState )
+{
+    uint32_t q[NET_FIELD_COUNT];
+    uint32_t changedMask;
+    uint32_t pos = 0;
+
+    quantize_state( baseline, q );
+
+    if( !read_varint( buffer, bufferSize, &pos, &changedMask ) || changedMask >= ( 1u << NET_FIELD_COUNT ))
+        return 0;
+
+    for( int i = 0; i < NET_FIELD_COUNT; ++i )
+    {
+        if( !( changedMask & ( 1u << i )))
+            continue;
+
+        uint32_t encoded;
+        if( !read_varint( buffer, bufferSize, &pos, &encoded ))
+            return 0;
+
+        q[i] = field_apply( i, encoded, q[i] );
+    }
+
+    dequantize_state( q, outState );
+    return pos;
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libsm64.h"
+
+struct MarioState;
+
+extern void net_state_from_mario( const struct MarioState *m, struct SM64MarioNetState *outState );
+extern uint32_t net_state_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *state, uint8_t *outBuffer, uint32_t bufferSize );
+extern uint32_t net_state_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t bufferSize, struct SM64MarioNetState *outState );
\ No newline at end of file
@@ -2,36 +2,123 @@
 
 #include <stdlib.h>
 
-uint32_t obj_pool_alloc_index( struct ObjPool *pool, size_t size )
+// Chunks start on a cache line and objects are padded to a multiple of one, the pointer
+// returned by malloc is stashed just before the chunk.
+#define OBJ_POOL_ALIGNMENT 64
+#define OBJ_POOL_CHUNK_SLOTS 16
+
+#define HANDLE_GENERATION( handle ) ( (handle) >> 16 )
+#define MAKE_HANDLE( generation, slot ) ( ((uint32_t)(generation) << 16) | (uint32_t)(slot) )
+#define GENERATION_MASK 0x7FFF // Keeps handles positive when they're passed around as int32_t
+
+static void *aligned_chunk_alloc( size_t size )
+{
+    uint8_t *block = malloc( size + sizeof( void * ) + OBJ_POOL_ALIGNMENT - 1 );
+    uintptr_t aligned = ((uintptr_t)block + sizeof( void * ) + OBJ_POOL_ALIGNMENT - 1) & ~(uintptr_t)( OBJ_POOL_ALIGNMENT - 1 );
+    ((void **)aligned)[-1] = block;
+    return (void *)aligned;
+}
+
+static void aligned_chunk_free( void *chunk )
 {
-    for( uint32_t i = 0; i < pool->size; ++i )
+    free( ((void **)chunk)[-1] );
+}
+
+static size_t object_stride( struct ObjPool *pool )
+{
+    return ( pool->objectSize + OBJ_POOL_ALIGNMENT - 1 ) & ~(size_t)( OBJ_POOL_ALIGNMENT - 1 );
+}
+
+static void grow_pool( struct ObjPool *pool )
+{
+    uint32_t numChunks = pool->capacity / OBJ_POOL_CHUNK_SLOTS;
+    uint32_t firstSlot = pool->capacity;
+
+    pool->chunks = realloc( pool->chunks, ( numChunks + 1 ) * sizeof( uint8_t * ));
+    pool->chunks[numChunks] = aligned_chunk_alloc( OBJ_POOL_CHUNK_SLOTS * object_stride( pool ));
+
+    pool->capacity += OBJ_POOL_CHUNK_SLOTS;
+    pool->slots = realloc( pool->slots, pool->capacity * sizeof( struct ObjPoolSlot ));
+
+    // Pushed in reverse so the lowest slots get handed out first
+    for( uint32_t i = pool->capacity; i-- > firstSlot; )
     {
-        if( pool->objects[i] == NULL )
-        {
-            pool->objects[i] = malloc( size );
-            return i;
-        }
+        pool->slots[i].generation = 0;
+        pool->slots[i].live = 0;
+        pool->slots[i].nextFree = pool->freeHead;
+        pool->freeHead = i;
     }
+}
 
-    uint32_t i = pool->size;
-    pool->size++;
-    pool->objects = realloc( pool->objects, pool->size * sizeof( void * ));
-    pool->objects[i] = malloc( size );
-    return i;
+static void *slot_object( struct ObjPool *pool, uint32_t slot )
+{
+    return pool->chunks[slot / OBJ_POOL_CHUNK_SLOTS] + ( slot % OBJ_POOL_CHUNK_SLOTS ) * object_stride( pool );
 }
 
-void obj_pool_free_index( struct ObjPool *pool, uint32_t index )
+uint32_t obj_pool_alloc( struct ObjPool *pool )
 {
-    free( pool->objects[index] );
-    pool->objects[index] = NULL;
+    if( pool->freeHead == OBJ_POOL_INVALID_HANDLE )
+    {
+        if( pool->capacity >= OBJ_POOL_MAX_SLOTS )
+            return OBJ_POOL_INVALID_HANDLE;
+
+        grow_pool( pool );
+    }
+
+    uint32_t slot = pool->freeHead;
+    struct ObjPoolSlot *slotInfo = &pool->slots[slot];
+
+    pool->freeHead = slotInfo->nextFree;
+    slotInfo->live = 1;
+
+    return MAKE_HANDLE( slotInfo->generation, slot );
+}
+
+void *obj_pool_get( struct ObjPool *pool, uint32_t handle )
+{
+    uint32_t slot = OBJ_POOL_HANDLE_SLOT( handle );
+
+    if( slot >= pool->capacity )
+        return NULL;
+
+    struct ObjPoolSlot *slotInfo = &pool->slots[slot];
+    if( !slotInfo->live || slotInfo->generation != HANDLE_GENERATION( handle ))
+        return NULL;
+
+    return slot_object( pool, slot );
+}
+
+void obj_pool_free( struct ObjPool *pool, uint32_t handle )
+{
+    if( obj_pool_get( pool, handle ) == NULL )
+        return;
+
+    uint32_t slot = OBJ_POOL_HANDLE_SLOT( handle );
+    struct ObjPoolSlot *slotInfo = &pool->slots[slot];
+
+    slotInfo->live = 0;
+    slotInfo->generation = ( slotInfo->generation + 1 ) & GENERATION_MASK;
+    slotInfo->nextFree = pool->freeHead;
+    pool->freeHead = slot;
+}
+
+uint32_t obj_pool_handle_at( struct ObjPool *pool, uint32_t slot )
+{
+    if( slot >= pool->capacity || !pool->slots[slot].live )
+        return OBJ_POOL_INVALID_HANDLE;
+
+    return MAKE_HANDLE( pool->slots[slot].generation, slot );
 }
 
 void obj_pool_free_all( struct ObjPool *pool )
 {
-    for( uint32_t i = 0; i < pool->size; ++i )
-        free( pool->objects[i] );
-    free( pool->objects );
+    for( uint32_t i = 0; i < pool->capacity / OBJ_POOL_CHUNK_SLOTS; ++i )
+        aligned_chunk_free( pool->chunks[i] );
+    free( pool->chunks );
+    free( pool->slots );
 
-    pool->size = 0;
-    pool->objects = NULL;
+    pool->capacity = 0;
+    pool->freeHead = OBJ_POOL_INVALID_HANDLE;
+    pool->slots = NULL;
+    pool->chunks = NULL;
 }
\ No newline at end of file
@@ -3,12 +3,36 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Handles are (generation << 16) | slot. A slot's generation is bumped whenever it's freed, so
+// a handle to a deleted object never matches whatever gets allocated in its slot afterwards.
+#define OBJ_POOL_INVALID_HANDLE 0xFFFFFFFF
+#define OBJ_POOL_MAX_SLOTS 0x10000
+#define OBJ_POOL_HANDLE_SLOT( handle ) ( (handle) & 0xFFFF )
+
+struct ObjPoolSlot
+{
+    uint16_t generation;
+    uint16_t live;
+    uint32_t nextFree;
+};
+
+// Objects are stored inline in fixed size chunks that never move once allocated, so pointers
+// into an object stay valid while the pool grows.
 struct ObjPool
 {
-    size_t size;
-    void **objects;
+    size_t objectSize;
+    uint32_t capacity;
+    uint32_t freeHead;
+    struct ObjPoolSlot *slots;
+    uint8_t **chunks;
 };
 
-extern uint32_t obj_pool_alloc_index( struct ObjPool *pool, size_t size );
-extern void obj_pool_free_index( struct ObjPool *pool, uint32_t index );
-extern void obj_pool_free_all( struct ObjPool *pool );
\ No newline at end of file
+#define OBJ_POOL_INIT( type ) { sizeof( type ), 0, OBJ_POOL_INVALID_HANDLE, NULL, NULL }
+
+extern uint32_t obj_pool_alloc( struct ObjPool *pool );
+extern void *obj_pool_get( struct ObjPool *pool, uint32_t handle );
+extern void obj_pool_free( struct ObjPool *pool, uint32_t handle );
+extern void obj_pool_free_all( struct ObjPool *pool );
+
+// Walks slots rather than handles, returns OBJ_POOL_INVALID_HANDLE for free ones.
+extern uint32_t obj_pool_handle_at( struct ObjPool *pool, uint32_t slot );
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SM64_PROFILE
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Stats per pool slot, plus what the tick in progress has spent in each phase so far. Phases
+// can be entered several times per tick (collision) so they're summed and recorded once at the end.
+static struct SM64ProfileStats *s_stats = NULL;
+static uint32_t s_stats_count = 0;
+static struct SM64ProfileStats *s_current = NULL;
+static uint64_t s_tick_nanoseconds[SM64_PROFILE_PHASE_COUNT];
+
+uint64_t profile_now( void )
+{
+#if defined(_WIN32)
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if( frequency.QuadPart == 0 )
+        QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &counter );
+    return (uint64_t)( counter.QuadPart / frequency.QuadPart ) * 1000000000ull
+        + (uint64_t)( counter.QuadPart % frequency.QuadPart ) * 1000000000ull / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void profile_add( enum SM64ProfilePhase phase, uint64_t nanoseconds )
+{
+    if( s_current != NULL )
+        s_tick_nanoseconds[phase] += nanoseconds;
+}
+
+void profile_begin_tick( uint32_t slot )
+{
+    if( slot >= s_stats_count )
+    {
+        uint32_t newCount = slot + 1 > 2 * s_stats_count ? slot + 1 : 2 * s_stats_count;
+        s_stats = realloc( s_stats, newCount * sizeof( struct SM64ProfileStats ));
+        memset( s_stats + s_stats_count, 0, ( newCount - s_stats_count ) * sizeof( struct SM64ProfileStats ));
+        s_stats_count = newCount;
+    }
+
+    s_current = &s_stats[slot];
+    memset( s_tick_nanoseconds, 0, sizeof( s_tick_nanoseconds ));
+}
+
+static uint32_t histogram_bucket( uint64_t nanoseconds )
+{
+    uint32_t bucket = 0;
+    nanoseconds >>= 10;
+    while( nanoseconds > 0 && bucket < SM64_PROFILE_HISTOGRAM_BUCKETS - 1 )
+    {
+        nanoseconds >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void profile_end_tick( void )
+{
+    if( s_current == NULL )
+        return;
+
+    for( int i = 0; i < SM64_PROFILE_PHASE_COUNT; ++i )
+    {
+        struct SM64ProfilePhaseStats *phase = &s_current->phases[i];
+        uint64_t ns = s_tick_nanoseconds[i];
+
+        if( phase->samples == 0 || ns < phase->minNanoseconds )
+            phase->minNanoseconds = ns;
+        if( ns > phase->maxNanoseconds )
+            phase->maxNanoseconds = ns;
+
+        phase->totalNanoseconds += ns;
+        phase->samples++;
+        phase->histogram[histogram_bucket( ns )]++;
+    }
+
+    s_current = NULL;
+}
+
+void profile_reset( uint32_t slot )
+{
+    if( slot < s_stats_count )
+        memset( &s_stats[slot], 0, sizeof( struct SM64ProfileStats ));
+}
+
+void profile_terminate( void )
+{
+    free( s_stats );
+    s_stats = NULL;
+    s_stats_count = 0;
+    s_current = NULL;
+}
+
+bool profile_get( uint32_t slot, struct SM64ProfileStats *outStats )
+{
+    if( slot < s_stats_count )
+        *outStats = s_stats[slot];
+    else
+        memset( outStats, 0, sizeof( struct SM64ProfileStats ));
+    return true;
+}
+
+#else
+
+bool profile_get( uint32_t slot, struct SM64ProfileStats *outStats )
+{
+    memset( outStats, 0, sizeof( struct SM64ProfileStats ));
+    return false;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libsm64.h"
+
+// Built with LIBSM64_PROFILE=1 only, otherwise every macro here expands to nothing and
+// sm64_profile_get always fails.
+#ifdef SM64_PROFILE
+
+extern uint64_t profile_now( void );
+extern void profile_add( enum SM64ProfilePhase phase, uint64_t nanoseconds );
+extern void profile_begin_tick( uint32_t slot );
+extern void profile_end_tick( void );
+extern void profile_reset( uint32_t slot );
+extern void profile_terminate( void );
+
+#define PROFILE_BEGIN( phase ) uint64_t profileStart_##phase = profile_now()
+#define PROFILE_END( phase ) profile_add( phase, profile_now() - profileStart_##phase )
+#define PROFILE_BEGIN_TICK( slot ) profile_begin_tick( slot )
+#define PROFILE_END_TICK() profile_end_tick()
+#define PROFILE_RESET( slot ) profile_reset( slot )
+#define PROFILE_TERMINATE() profile_terminate()
+
+#else
+
+#define PROFILE_BEGIN( phase )
+#define PROFILE_END( phase )
+#define PROFILE_BEGIN_TICK( slot )
+#define PROFILE_END_TICK()
+#define PROFILE_RESET( slot )
+#define PROFILE_TERMINATE()
+
+#endif
+
+extern bool profile_get( uint32_t slot, struct SM64ProfileStats *outStats );
\ No newline at end of file
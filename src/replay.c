@@ -0,0 +1,451 @@
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug_print.h"
+
+/**
+ * A replay stream is a header followed by one record per API call that can change a Mario:
+ * the op as a byte, the Mario or surface object id it was called with, then its arguments as
+ * 32 bit values. Ticks store the inputs along with a hash of the state the tick produced, so a
+ * replay can tell exactly which tick diverged. Values are written in host byte order.
+ *
+ * Static surfaces aren't recorded, the level has to be loaded the same way before replaying.
+ */
+
+#define REPLAY_MAGIC 0x52344D53 // "SM4R"
+#define REPLAY_VERSION 1
+
+#define TICK_ARGS 6 // camLookX, camLookZ, stickX, stickY, buttons, state hash
+#define SURFACE_ARGS 12 // type, force, terrain, vertices
+#define SURFACE_OBJECT_ARGS 7 // transform, surfaceCount, then SURFACE_ARGS per surface
+#define VARIABLE_ARGS 0xFF
+#define MAX_ARGS 8
+
+static const uint8_t s_arg_counts[REPLAY_OP_COUNT] = {
+    [REPLAY_OP_MARIO_CREATE]               = 3,
+    [REPLAY_OP_MARIO_TICK]                 = TICK_ARGS,
+    [REPLAY_OP_MARIO_DELETE]               = 0,
+    [REPLAY_OP_SET_MARIO_ACTION]           = 1,
+    [REPLAY_OP_SET_MARIO_ACTION_ARG]       = 2,
+    [REPLAY_OP_SET_MARIO_ANIMATION]        = 1,
+    [REPLAY_OP_SET_MARIO_ANIM_FRAME]       = 1,
+    [REPLAY_OP_SET_MARIO_STATE]            = 1,
+    [REPLAY_OP_SET_MARIO_POSITION]         = 3,
+    [REPLAY_OP_SET_MARIO_ANGLE]            = 3,
+    [REPLAY_OP_SET_MARIO_FACEANGLE]        = 1,
+    [REPLAY_OP_SET_MARIO_VELOCITY]         = 3,
+    [REPLAY_OP_SET_MARIO_FORWARD_VELOCITY] = 1,
+    [REPLAY_OP_SET_MARIO_INVINCIBILITY]    = 1,
+    [REPLAY_OP_SET_MARIO_WATER_LEVEL]      = 1,
+    [REPLAY_OP_SET_MARIO_GAS_LEVEL]        = 1,
+    [REPLAY_OP_SET_MARIO_HEALTH]           = 1,
+    [REPLAY_OP_MARIO_TAKE_DAMAGE]          = 5,
+    [REPLAY_OP_MARIO_HEAL]                 = 1,
+    [REPLAY_OP_MARIO_KILL]                 = 0,
+    [REPLAY_OP_MARIO_INTERACT_CAP]         = 3,
+    [REPLAY_OP_MARIO_EXTEND_CAP]           = 1,
+    [REPLAY_OP_MARIO_ATTACK]               = 4,
+    [REPLAY_OP_SURFACE_OBJECT_CREATE]      = VARIABLE_ARGS,
+    [REPLAY_OP_SURFACE_OBJECT_MOVE]        = 6,
+    [REPLAY_OP_SURFACE_OBJECT_DELETE]      = 0,
+};
+
+struct ReplayHeader
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct ReplayBuffer
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+};
+
+bool g_replay_recording = false;
+static struct ReplayBuffer s_record_buffer = { NULL, 0, 0 };
+
+static void buffer_write( struct ReplayBuffer *buffer, const void *data, size_t size )
+{
+    // Calls without arguments pass no data at all
+    if( size == 0 )
+        return;
+
+    if( buffer->size + size > buffer->capacity )
+    {
+        size_t newCapacity = buffer->capacity > 0 ? buffer->capacity : 0x1000;
+        while( newCapacity < buffer->size + size )
+            newCapacity *= 2;
+
+        buffer->data = realloc( buffer->data, newCapacity );
+        buffer->capacity = newCapacity;
+    }
+
+    memcpy( buffer->data + buffer->size, data, size );
+    buffer->size += size;
+}
+
+static void write_record_start( enum ReplayOp op, uint32_t id )
+{
+    uint8_t opByte = (uint8_t)op;
+    buffer_write( &s_record_buffer, &opByte, 1 );
+    buffer_write( &s_record_buffer, &id, sizeof( uint32_t ));
+}
+
+void replay_record_start( void )
+{
+    struct ReplayHeader header = { REPLAY_MAGIC, REPLAY_VERSION };
+
+    s_record_buffer.size = 0;
+    buffer_write( &s_record_buffer, &header, sizeof( struct ReplayHeader ));
+    g_replay_recording = true;
+}
+
+const uint8_t *replay_record_stop( size_t *outSize )
+{
+    g_replay_recording = false;
+
+    if( outSize )
+        *outSize = s_record_buffer.size;
+
+    return s_record_buffer.data;
+}
+
+void replay_terminate( void )
+{
+    g_replay_recording = false;
+
+    free( s_record_buffer.data );
+    s_record_buffer.data = NULL;
+    s_record_buffer.size = 0;
+    s_record_buffer.capacity = 0;
+}
+
+void replay_record_call( enum ReplayOp op, uint32_t id, const union ReplayArg *args, uint32_t numArgs )
+{
+    write_record_start( op, id );
+    buffer_write( &s_record_buffer, args, numArgs * sizeof( union ReplayArg ));
+}
+
+void replay_record_mario_tick( uint32_t marioId, const struct SM64MarioInputs *inputs, const struct SM64MarioState *state )
+{
+    uint32_t buttons = ( inputs->buttonA ? 1 : 0 ) | ( inputs->buttonB ? 2 : 0 ) | ( inputs->buttonZ ? 4 : 0 );
+
+    union ReplayArg args[TICK_ARGS] = {
+        REPLAY_F( inputs->camLookX ),
+        REPLAY_F( inputs->camLookZ ),
+        REPLAY_F( inputs->stickX ),
+        REPLAY_F( inputs->stickY ),
+        REPLAY_U( buttons ),
+        REPLAY_U( replay_hash_mario_state( state )),
+    };
+
+    replay_record_call( REPLAY_OP_MARIO_TICK, marioId, args, TICK_ARGS );
+}
+
+void replay_record_surface_object_create( uint32_t objectId, const struct SM64SurfaceObject *surfaceObject )
+{
+    const struct SM64ObjectTransform *transform = &surfaceObject->transform;
+
+    union ReplayArg args[SURFACE_OBJECT_ARGS] = {
+        REPLAY_F( transform->position[0] ),
+        REPLAY_F( transform->position[1] ),
+        REPLAY_F( transform->position[2] ),
+        REPLAY_F( transform->eulerRotation[0] ),
+        REPLAY_F( transform->eulerRotation[1] ),
+        REPLAY_F( transform->eulerRotation[2] ),
+        REPLAY_U( surfaceObject->surfaceCount ),
+    };
+
+    replay_record_call( REPLAY_OP_SURFACE_OBJECT_CREATE, objectId, args, SURFACE_OBJECT_ARGS );
+
+    for( uint32_t i = 0; i < surfaceObject->surfaceCount; ++i )
+    {
+        const struct SM64Surface *surface = &surfaceObject->surfaces[i];
+        union ReplayArg surfaceArgs[SURFACE_ARGS];
+
+        surfaceArgs[0] = REPLAY_S( surface->type );
+        surfaceArgs[1] = REPLAY_S( surface->force );
+        surfaceArgs[2] = REPLAY_U( surface->terrain );
+        for( int j = 0; j < 9; ++j )
+            surfaceArgs[3 + j] = REPLAY_S( surface->vertices[j / 3][j % 3] );
+
+        buffer_write( &s_record_buffer, surfaceArgs, sizeof( surfaceArgs ));
+    }
+}
+
+void replay_record_surface_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform )
+{
+    REPLAY_RECORD_CALL( REPLAY_OP_SURFACE_OBJECT_MOVE, objectId,
+        REPLAY_F( transform->position[0] ),
+        REPLAY_F( transform->position[1] ),
+        REPLAY_F( transform->position[2] ),
+        REPLAY_F( transform->eulerRotation[0] ),
+        REPLAY_F( transform->eulerRotation[1] ),
+        REPLAY_F( transform->eulerRotation[2] ));
+}
+
+static uint32_t fnv1a( uint32_t hash, const void *data, size_t size )
+{
+    const uint8_t *bytes = data;
+    for( size_t i = 0; i < size; ++i )
+        hash = ( hash ^ bytes[i] ) * 16777619u;
+    return hash;
+}
+
+// Hashed field by field, SM64MarioState has padding that isn't guaranteed to be zeroed
+uint32_t replay_hash_mario_state( const struct SM64MarioState *state )
+{
+    uint32_t hash = 2166136261u;
+
+    hash = fnv1a( hash, state->position, sizeof( state->position ));
+    hash = fnv1a( hash, state->velocity, sizeof( state->velocity ));
+    hash = fnv1a( hash, &state->faceAngle, sizeof( state->faceAngle ));
+    hash = fnv1a( hash, &state->health, sizeof( state->health ));
+    hash = fnv1a( hash, &state->action, sizeof( state->action ));
+    hash = fnv1a( hash, &state->flags, sizeof( state->flags ));
+    hash = fnv1a( hash, &state->particleFlags, sizeof( state->particleFlags ));
+    hash = fnv1a( hash, &state->invincTimer, sizeof( state->invincTimer ));
+
+    return hash;
+}
+
+// Ids handed out while replaying won't match the recorded ones
+struct ReplayIdMap
+{
+    uint32_t *recorded;
+    uint32_t *replayed;
+    uint32_t count;
+};
+
+static void id_map_add( struct ReplayIdMap *map, uint32_t recorded, uint32_t replayed )
+{
+    map->recorded = realloc( map->recorded, ( map->count + 1 ) * sizeof( uint32_t ));
+    map->replayed = realloc( map->replayed, ( map->count + 1 ) * sizeof( uint32_t ));
+    map->recorded[map->count] = recorded;
+    map->replayed[map->count] = replayed;
+    map->count++;
+}
+
+static uint32_t id_map_get( const struct ReplayIdMap *map, uint32_t recorded )
+{
+    for( uint32_t i = map->count; i-- > 0; )
+        if( map->recorded[i] == recorded )
+            return map->replayed[i];
+
+    return 0xFFFFFFFF;
+}
+
+static uint32_t id_map_remove( struct ReplayIdMap *map, uint32_t recorded )
+{
+    for( uint32_t i = map->count; i-- > 0; )
+    {
+        if( map->recorded[i] == recorded )
+        {
+            uint32_t replayed = map->replayed[i];
+            map->replayed[i] = 0xFFFFFFFF;
+            return replayed;
+        }
+    }
+
+    return 0xFFFFFFFF;
+}
+
+static void id_map_free( struct ReplayIdMap *map )
+{
+    free( map->recorded );
+    free( map->replayed );
+}
+
+static void apply_mario_call( enum ReplayOp op, int32_t id, const union ReplayArg *a )
+{
+    switch( op )
+    {
+        case REPLAY_OP_SET_MARIO_ACTION:           sm64_set_mario_action( id, a[0].u ); break;
+        case REPLAY_OP_SET_MARIO_ACTION_ARG:       sm64_set_mario_action_arg( id, a[0].u, a[1].u ); break;
+        case REPLAY_OP_SET_MARIO_ANIMATION:        sm64_set_mario_animation( id, a[0].s ); break;
+        case REPLAY_OP_SET_MARIO_ANIM_FRAME:       sm64_set_mario_anim_frame( id, (int16_t)a[0].s ); break;
+        case REPLAY_OP_SET_MARIO_STATE:            sm64_set_mario_state( id, a[0].u ); break;
+        case REPLAY_OP_SET_MARIO_POSITION:         sm64_set_mario_position( id, a[0].f, a[1].f, a[2].f ); break;
+        case REPLAY_OP_SET_MARIO_ANGLE:            sm64_set_mario_angle( id, a[0].f, a[1].f, a[2].f ); break;
+        case REPLAY_OP_SET_MARIO_FACEANGLE:        sm64_set_mario_faceangle( id, a[0].f ); break;
+        case REPLAY_OP_SET_MARIO_VELOCITY:         sm64_set_mario_velocity( id, a[0].f, a[1].f, a[2].f ); break;
+        case REPLAY_OP_SET_MARIO_FORWARD_VELOCITY: sm64_set_mario_forward_velocity( id, a[0].f ); break;
+        case REPLAY_OP_SET_MARIO_INVINCIBILITY:    sm64_set_mario_invincibility( id, (int16_t)a[0].s ); break;
+        case REPLAY_OP_SET_MARIO_WATER_LEVEL:      sm64_set_mario_water_level( id, a[0].s ); break;
+        case REPLAY_OP_SET_MARIO_GAS_LEVEL:        sm64_set_mario_gas_level( id, a[0].s ); break;
+        case REPLAY_OP_SET_MARIO_HEALTH:           sm64_set_mario_health( id, (uint16_t)a[0].u ); break;
+        case REPLAY_OP_MARIO_TAKE_DAMAGE:          sm64_mario_take_damage( id, a[0].u, a[1].u, a[2].f, a[3].f, a[4].f ); break;
+        case REPLAY_OP_MARIO_HEAL:                 sm64_mario_heal( id, (uint8_t)a[0].u ); break;
+        case REPLAY_OP_MARIO_KILL:                 sm64_mario_kill( id ); break;
+        case REPLAY_OP_MARIO_INTERACT_CAP:         sm64_mario_interact_cap( id, a[0].u, (uint16_t)a[1].u, (uint8_t)a[2].u ); break;
+        case REPLAY_OP_MARIO_EXTEND_CAP:           sm64_mario_extend_cap( id, (uint16_t)a[0].u ); break;
+        case REPLAY_OP_MARIO_ATTACK:               sm64_mario_attack( id, a[0].f, a[1].f, a[2].f, a[3].f ); break;
+        default: break;
+    }
+}
+
+/**
+ * Runs a recorded stream against the currently loaded level as fast as possible. The hash of
+ * every tick's state is written to outTickHashes (up to maxTickHashes of them) and the index of
+ * the first tick whose hash doesn't match the recording goes to outFirstMismatch, or -1 if they
+ * all match. Marios and surface objects created by the replay are deleted when it ends.
+ */
+uint32_t replay_run( const uint8_t *stream, size_t size, uint32_t *outTickHashes, uint32_t maxTickHashes, int32_t *outFirstMismatch )
+{
+    struct ReplayHeader header;
+    struct ReplayIdMap marios = { NULL, NULL, 0 };
+    struct ReplayIdMap objects = { NULL, NULL, 0 };
+    struct SM64MarioGeometryBuffers geometry;
+    struct SM64MarioState state;
+    uint32_t numTicks = 0;
+    size_t pos = sizeof( struct ReplayHeader );
+    bool wasRecording = g_replay_recording;
+
+    if( outFirstMismatch )
+        *outFirstMismatch = -1;
+
+    if( size < sizeof( struct ReplayHeader ))
+        return 0;
+
+    memcpy( &header, stream, sizeof( struct ReplayHeader ));
+    if( header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION )
+    {
+        DEBUG_PRINT("Replay stream has an unknown format");
+        return 0;
+    }
+
+    memset( &geometry, 0, sizeof( struct SM64MarioGeometryBuffers ));
+    geometry.position = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+    geometry.normal   = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+    geometry.color    = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+    geometry.uv       = malloc( sizeof( float ) * 6 * SM64_GEO_MAX_TRIANGLES );
+
+    // The replay's own calls shouldn't end up in a recording
+    g_replay_recording = false;
+
+    while( pos + 1 + sizeof( uint32_t ) <= size )
+    {
+        uint8_t op = stream[pos];
+        uint32_t recordedId;
+        union ReplayArg args[MAX_ARGS];
+
+        memcpy( &recordedId, stream + pos + 1, sizeof( uint32_t ));
+        pos += 1 + sizeof( uint32_t );
+
+        if( op >= REPLAY_OP_COUNT )
+        {
+            DEBUG_PRINT("Replay stream has an unknown op: %u", op);
+            break;
+        }
+
+        uint32_t numArgs = s_arg_counts[op] == VARIABLE_ARGS ? SURFACE_OBJECT_ARGS : s_arg_counts[op];
+        if( pos + numArgs * sizeof( union ReplayArg ) > size )
+            break;
+
+        memcpy( args, stream + pos, numArgs * sizeof( union ReplayArg ));
+        pos += numArgs * sizeof( union ReplayArg );
+
+        if( op == REPLAY_OP_MARIO_CREATE )
+        {
+            id_map_add( &marios, recordedId, (uint32_t)sm64_mario_create( args[0].f, args[1].f, args[2].f ));
+        }
+        else if( op == REPLAY_OP_MARIO_TICK )
+        {
+            struct SM64MarioInputs inputs;
+            inputs.camLookX = args[0].f;
+            inputs.camLookZ = args[1].f;
+            inputs.stickX = args[2].f;
+            inputs.stickY = args[3].f;
+            inputs.buttonA = ( args[4].u & 1 ) != 0;
+            inputs.buttonB = ( args[4].u & 2 ) != 0;
+            inputs.buttonZ = ( args[4].u & 4 ) != 0;
+
+            memset( &state, 0, sizeof( struct SM64MarioState ));
+            sm64_mario_tick( (int32_t)id_map_get( &marios, recordedId ), &inputs, &state, &geometry );
+
+            uint32_t hash = replay_hash_mario_state( &state );
+            if( numTicks < maxTickHashes && outTickHashes )
+                outTickHashes[numTicks] = hash;
+            if( hash != args[5].u && outFirstMismatch && *outFirstMismatch < 0 )
+                *outFirstMismatch = (int32_t)numTicks;
+
+            numTicks++;
+        }
+        else if( op == REPLAY_OP_MARIO_DELETE )
+        {
+            sm64_mario_delete( (int32_t)id_map_remove( &marios, recordedId ));
+        }
+        else if( op == REPLAY_OP_SURFACE_OBJECT_CREATE )
+        {
+            struct SM64SurfaceObject surfaceObject;
+            uint32_t surfaceCount = args[6].u;
+
+            if( pos + (size_t)surfaceCount * SURFACE_ARGS * sizeof( union ReplayArg ) > size )
+                break;
+
+            for( int i = 0; i < 3; ++i )
+            {
+                surfaceObject.transform.position[i] = args[i].f;
+                surfaceObject.transform.eulerRotation[i] = args[3 + i].f;
+            }
+            surfaceObject.surfaceCount = surfaceCount;
+            surfaceObject.surfaces = malloc( surfaceCount * sizeof( struct SM64Surface ));
+
+            for( uint32_t i = 0; i < surfaceCount; ++i )
+            {
+                union ReplayArg surfaceArgs[SURFACE_ARGS];
+                memcpy( surfaceArgs, stream + pos, sizeof( surfaceArgs ));
+                pos += sizeof( surfaceArgs );
+
+                surfaceObject.surfaces[i].type = (int16_t)surfaceArgs[0].s;
+                surfaceObject.surfaces[i].force = (int16_t)surfaceArgs[1].s;
+                surfaceObject.surfaces[i].terrain = (uint16_t)surfaceArgs[2].u;
+                for( int j = 0; j < 9; ++j )
+                    surfaceObject.surfaces[i].vertices[j / 3][j % 3] = surfaceArgs[3 + j].s;
+            }
+
+            id_map_add( &objects, recordedId, sm64_surface_object_create( &surfaceObject ));
+            free( surfaceObject.surfaces );
+        }
+        else if( op == REPLAY_OP_SURFACE_OBJECT_MOVE )
+        {
+            struct SM64ObjectTransform transform;
+            for( int i = 0; i < 3; ++i )
+            {
+                transform.position[i] = args[i].f;
+                transform.eulerRotation[i] = args[3 + i].f;
+            }
+            sm64_surface_object_move( id_map_get( &objects, recordedId ), &transform );
+        }
+        else if( op == REPLAY_OP_SURFACE_OBJECT_DELETE )
+        {
+            sm64_surface_object_delete( id_map_remove( &objects, recordedId ));
+        }
+        else
+        {
+            apply_mario_call( op, (int32_t)id_map_get( &marios, recordedId ), args );
+        }
+    }
+
+    for( uint32_t i = 0; i < marios.count; ++i )
+        if( (int32_t)marios.replayed[i] >= 0 )
+            sm64_mario_delete( (int32_t)marios.replayed[i] );
+    for( uint32_t i = 0; i < objects.count; ++i )
+        if( objects.replayed[i] != 0xFFFFFFFF )
+            sm64_surface_object_delete( objects.replayed[i] );
+
+    g_replay_recording = wasRecording;
+
+    id_map_free( &marios );
+    id_map_free( &objects );
+    free( geometry.position );
+    free( geometry.normal );
+    free( geometry.color );
+    free( geometry.uv );
+
+    return numTicks;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libsm64.h"
+
+// One op per recorded API call, the values are part of the stream format so only append to this
+enum ReplayOp
+{
+    REPLAY_OP_MARIO_CREATE,
+    REPLAY_OP_MARIO_TICK,
+    REPLAY_OP_MARIO_DELETE,
+    REPLAY_OP_SET_MARIO_ACTION,
+    REPLAY_OP_SET_MARIO_ACTION_ARG,
+    REPLAY_OP_SET_MARIO_ANIMATION,
+    REPLAY_OP_SET_MARIO_ANIM_FRAME,
+    REPLAY_OP_SET_MARIO_STATE,
+    REPLAY_OP_SET_MARIO_POSITION,
+    REPLAY_OP_SET_MARIO_ANGLE,
+    REPLAY_OP_SET_MARIO_FACEANGLE,
+    REPLAY_OP_SET_MARIO_VELOCITY,
+    REPLAY_OP_SET_MARIO_FORWARD_VELOCITY,
+    REPLAY_OP_SET_MARIO_INVINCIBILITY,
+    REPLAY_OP_SET_MARIO_WATER_LEVEL,
+    REPLAY_OP_SET_MARIO_GAS_LEVEL,
+    REPLAY_OP_SET_MARIO_HEALTH,
+    REPLAY_OP_MARIO_TAKE_DAMAGE,
+    REPLAY_OP_MARIO_HEAL,
+    REPLAY_OP_MARIO_KILL,
+    REPLAY_OP_MARIO_INTERACT_CAP,
+    REPLAY_OP_MARIO_EXTEND_CAP,
+    REPLAY_OP_MARIO_ATTACK,
+    REPLAY_OP_SURFACE_OBJECT_CREATE,
+    REPLAY_OP_SURFACE_OBJECT_MOVE,
+    REPLAY_OP_SURFACE_OBJECT_DELETE,
+    REPLAY_OP_COUNT
+};
+
+// Every setter argument fits in 32 bits, they're all stored as one of these
+union ReplayArg
+{
+    float f;
+    uint32_t u;
+    int32_t s;
+};
+
+#define REPLAY_F( x ) ((union ReplayArg){ .f = (float)(x) })
+#define REPLAY_U( x ) ((union ReplayArg){ .u = (uint32_t)(x) })
+#define REPLAY_S( x ) ((union ReplayArg){ .s = (int32_t)(x) })
+
+extern bool g_replay_recording;
+
+#define REPLAY_RECORD_CALL( op, id, ... ) do { \
+    if( g_replay_recording ) { \
+        union ReplayArg replayArgs_[] = { __VA_ARGS__ }; \
+        replay_record_call( op, (uint32_t)(id), replayArgs_, sizeof( replayArgs_ ) / sizeof( replayArgs_[0] )); \
+    } \
+} while( 0 )
+
+extern void replay_record_start( void );
+extern const uint8_t *replay_record_stop( size_t *outSize );
+extern void replay_terminate( void );
+
+extern void replay_record_call( enum ReplayOp op, uint32_t id, const union ReplayArg *args, uint32_t numArgs );
+extern void replay_record_mario_tick( uint32_t marioId, const struct SM64MarioInputs *inputs, const struct SM64MarioState *state );
+extern void replay_record_surface_object_create( uint32_t objectId, const struct SM64SurfaceObject *surfaceObject );
+extern void replay_record_surface_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform );
+
+extern uint32_t replay_hash_mario_state( const struct SM64MarioState *state );
+extern uint32_t replay_run( const uint8_t *stream, size_t size, uint32_t *outTickHashes, uint32_t maxTickHashes, int32_t *outFirstMismatch );
@@ -0,0 +1,336 @@
+#include "texture_atlas.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define ATLAS_WIDTH SM64_TEXTURE_WIDTH
+#define ATLAS_HEIGHT SM64_TEXTURE_HEIGHT
+
+// Copy of the atlas handed out by the last init, always RGBA so the encoders only deal with one
+// channel order. Premultiplied when s_atlas_flags says so.
+static uint8_t *s_atlas = NULL;
+static uint32_t s_atlas_flags = 0;
+
+void texture_atlas_store( const uint8_t *texture, uint32_t flags )
+{
+    if( !s_atlas )
+        s_atlas = malloc( 4 * ATLAS_WIDTH * ATLAS_HEIGHT );
+
+    memcpy( s_atlas, texture, 4 * ATLAS_WIDTH * ATLAS_HEIGHT );
+    s_atlas_flags = flags;
+
+    if( flags & SM64_TEXTURE_BGRA )
+    {
+        for( int i = 0; i < ATLAS_WIDTH * ATLAS_HEIGHT; ++i )
+        {
+            uint8_t t = s_atlas[4*i + 0];
+            s_atlas[4*i + 0] = s_atlas[4*i + 2];
+            s_atlas[4*i + 2] = t;
+        }
+    }
+}
+
+void texture_atlas_free( void )
+{
+    free( s_atlas );
+    s_atlas = NULL;
+    s_atlas_flags = 0;
+}
+
+static uint32_t mip_dimension( uint32_t size, uint32_t level )
+{
+    size >>= level;
+    return size ? size : 1;
+}
+
+static uint32_t full_mip_chain( void )
+{
+    uint32_t levels = 1;
+    while( mip_dimension( ATLAS_WIDTH, levels - 1 ) > 1 || mip_dimension( ATLAS_HEIGHT, levels - 1 ) > 1 )
+        levels++;
+    return levels;
+}
+
+static size_t level_size( enum SM64TextureFormat format, uint32_t w, uint32_t h )
+{
+    switch( format )
+    {
+        case SM64_TEXTURE_FORMAT_RGBA8:    return 4 * w * h;
+        case SM64_TEXTURE_FORMAT_RGB565:
+        case SM64_TEXTURE_FORMAT_RGBA5551: return 2 * w * h;
+        case SM64_TEXTURE_FORMAT_BC1:      return 8 * (( w + 3 ) / 4 ) * (( h + 3 ) / 4 );
+        case SM64_TEXTURE_FORMAT_BC3:      return 16 * (( w + 3 ) / 4 ) * (( h + 3 ) / 4 );
+    }
+    return 0;
+}
+
+// 2x2 box filter. Odd sizes drop the last row or column, except that a dimension already at 1 stays.
+static void downsample( const uint8_t *src, uint32_t sw, uint32_t sh, uint8_t *dst, uint32_t dw, uint32_t dh )
+{
+    for( uint32_t y = 0; y < dh; ++y )
+    for( uint32_t x = 0; x < dw; ++x )
+    {
+        uint32_t x0 = 2 * x < sw ? 2 * x : sw - 1, x1 = 2 * x + 1 < sw ? 2 * x + 1 : sw - 1;
+        uint32_t y0 = 2 * y < sh ? 2 * y : sh - 1, y1 = 2 * y + 1 < sh ? 2 * y + 1 : sh - 1;
+
+        for( int c = 0; c < 4; ++c )
+        {
+            uint32_t sum = src[4 * ( x0 + y0 * sw ) + c] + src[4 * ( x1 + y0 * sw ) + c]
+                         + src[4 * ( x0 + y1 * sw ) + c] + src[4 * ( x1 + y1 * sw ) + c];
+            dst[4 * ( x + y * dw ) + c] = (uint8_t)(( sum + 2 ) / 4 );
+        }
+    }
+}
+
+static uint16_t pack_565( int r, int g, int b )
+{
+    return (uint16_t)(( r * 31 + 127 ) / 255 << 11 | ( g * 63 + 127 ) / 255 << 5 | ( b * 31 + 127 ) / 255 );
+}
+
+static void unpack_565( uint16_t c, int *rgb )
+{
+    int r = c >> 11, g = ( c >> 5 ) & 0x3F, b = c & 0x1F;
+    rgb[0] = r << 3 | r >> 2;
+    rgb[1] = g << 2 | g >> 4;
+    rgb[2] = b << 3 | b >> 2;
+}
+
+static void encode_16bit( const uint8_t *px, uint32_t count, bool alpha, uint8_t *out )
+{
+    for( uint32_t i = 0; i < count; ++i, px += 4, out += 2 )
+    {
+        uint16_t v = alpha
+            ? (uint16_t)(( px[0] * 31 + 127 ) / 255 << 11 | ( px[1] * 31 + 127 ) / 255 << 6 | ( px[2] * 31 + 127 ) / 255 << 1 | ( px[3] >= 128 ))
+            : pack_565( px[0], px[1], px[2] );
+        memcpy( out, &v, sizeof( uint16_t ));
+    }
+}
+
+/**
+ * BC1 color block from the bounding box of the block's colors, inset by 1/16 of its size to make
+ * up for the extremes rarely being hit exactly, then the nearest palette entry for each pixel.
+ * With transparentMode, pixels with alpha below 128 are left out of the box and use the
+ * transparent index of the 3 color mode, which BC1 selects by ordering color0 <= color1.
+ * Otherwise the 4 color mode is used, which needs color0 > color1.
+ */
+static void encode_bc1_color( const uint8_t block[16][4], bool transparentMode, uint8_t *out )
+{
+    int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+    bool any_transparent = false, any_opaque = false;
+
+    for( int i = 0; i < 16; ++i )
+    {
+        if( transparentMode && block[i][3] < 128 )
+        {
+            any_transparent = true;
+            continue;
+        }
+
+        any_opaque = true;
+        for( int c = 0; c < 3; ++c )
+        {
+            if( block[i][c] < lo[c] ) lo[c] = block[i][c];
+            if( block[i][c] > hi[c] ) hi[c] = block[i][c];
+        }
+    }
+
+    if( !any_opaque )
+        lo[0] = lo[1] = lo[2] = hi[0] = hi[1] = hi[2] = 0;
+
+    for( int c = 0; c < 3; ++c )
+    {
+        int inset = ( hi[c] - lo[c] ) / 16;
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+
+    uint16_t c0 = pack_565( hi[0], hi[1], hi[2] );
+    uint16_t c1 = pack_565( lo[0], lo[1], lo[2] );
+    bool three_color = transparentMode && any_transparent;
+
+    if( three_color ? c0 > c1 : c0 < c1 )
+    {
+        uint16_t t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+
+    int palette[4][3];
+    int num_colors = three_color ? 3 : 4;
+    unpack_565( c0, palette[0] );
+    unpack_565( c1, palette[1] );
+    for( int c = 0; c < 3; ++c )
+    {
+        if( three_color )
+        {
+            palette[2][c] = ( palette[0][c] + palette[1][c] ) / 2;
+        }
+        else
+        {
+            palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+            palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+        }
+    }
+
+    uint32_t indices = 0;
+    for( int i = 0; i < 16; ++i )
+    {
+        uint32_t best = 3;
+
+        if( !three_color || block[i][3] >= 128 )
+        {
+            int best_dist = 0x7FFFFFFF;
+            for( int p = 0; p < num_colors; ++p )
+            {
+                int dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+                int dist = dr * dr + dg * dg + db * db;
+                if( dist < best_dist )
+                {
+                    best_dist = dist;
+                    best = (uint32_t)p;
+                }
+            }
+        }
+
+        indices |= best << ( 2 * i );
+    }
+
+    out[0] = c0 & 0xFF; out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF; out[3] = c1 >> 8;
+    out[4] = indices & 0xFF; out[5] = ( indices >> 8 ) & 0xFF; out[6] = ( indices >> 16 ) & 0xFF; out[7] = indices >> 24;
+}
+
+// BC3 alpha block in the 8 value mode, alpha0 > alpha1, with the block's alpha range as endpoints
+static void encode_bc3_alpha( const uint8_t block[16][4], uint8_t *out )
+{
+    int lo = 255, hi = 0;
+    for( int i = 0; i < 16; ++i )
+    {
+        if( block[i][3] < lo ) lo = block[i][3];
+        if( block[i][3] > hi ) hi = block[i][3];
+    }
+
+    int palette[8] = { hi, lo };
+    for( int p = 1; p < 7; ++p )
+        palette[p + 1] = (( 7 - p ) * hi + p * lo ) / 7;
+
+    uint64_t indices = 0;
+    for( int i = 0; i < 16; ++i )
+    {
+        uint64_t best = 0;
+        int best_dist = 256;
+        for( int p = 0; p < 8 && hi > lo; ++p )
+        {
+            int dist = abs( block[i][3] - palette[p] );
+            if( dist < best_dist )
+            {
+                best_dist = dist;
+                best = (uint64_t)p;
+            }
+        }
+
+        indices |= best << ( 3 * i );
+    }
+
+    out[0] = (uint8_t)hi;
+    out[1] = (uint8_t)lo;
+    for( int i = 0; i < 6; ++i )
+        out[2 + i] = (uint8_t)( indices >> ( 8 * i ));
+}
+
+static void encode_bc( const uint8_t *px, uint32_t w, uint32_t h, bool bc3, uint8_t *out )
+{
+    uint8_t block[16][4];
+
+    for( uint32_t by = 0; by < h; by += 4 )
+    for( uint32_t bx = 0; bx < w; bx += 4 )
+    {
+        // Blocks hanging over the edge repeat the last row and column
+        for( uint32_t i = 0; i < 16; ++i )
+        {
+            uint32_t x = bx + i % 4 < w ? bx + i % 4 : w - 1;
+            uint32_t y = by + i / 4 < h ? by + i / 4 : h - 1;
+            memcpy( block[i], px + 4 * ( x + y * w ), 4 );
+        }
+
+        if( bc3 )
+        {
+            encode_bc3_alpha( block, out );
+            encode_bc1_color( block, false, out + 8 );
+            out += 16;
+        }
+        else
+        {
+            encode_bc1_color( block, true, out );
+            out += 8;
+        }
+    }
+}
+
+static void encode_level( enum SM64TextureFormat format, const uint8_t *px, uint32_t w, uint32_t h, uint8_t *out )
+{
+    switch( format )
+    {
+        case SM64_TEXTURE_FORMAT_RGBA8:
+            memcpy( out, px, 4 * w * h );
+            if( s_atlas_flags & SM64_TEXTURE_BGRA )
+            {
+                for( uint32_t i = 0; i < w * h; ++i )
+                {
+                    out[4*i + 0] = px[4*i + 2];
+                    out[4*i + 2] = px[4*i + 0];
+                }
+            }
+            break;
+        case SM64_TEXTURE_FORMAT_RGB565:   encode_16bit( px, w * h, false, out ); break;
+        case SM64_TEXTURE_FORMAT_RGBA5551: encode_16bit( px, w * h, true, out ); break;
+        case SM64_TEXTURE_FORMAT_BC1:      encode_bc( px, w, h, false, out ); break;
+        case SM64_TEXTURE_FORMAT_BC3:      encode_bc( px, w, h, true, out ); break;
+    }
+}
+
+size_t texture_atlas_export( enum SM64TextureFormat format, uint32_t mipLevels, uint8_t *out )
+{
+    if( !s_atlas || level_size( format, 1, 1 ) == 0 )
+        return 0;
+
+    uint32_t max_levels = full_mip_chain();
+    if( mipLevels == 0 || mipLevels > max_levels )
+        mipLevels = max_levels;
+
+    size_t size = 0;
+    for( uint32_t level = 0; level < mipLevels; ++level )
+        size += level_size( format, mip_dimension( ATLAS_WIDTH, level ), mip_dimension( ATLAS_HEIGHT, level ));
+
+    if( out == NULL )
+        return size;
+
+    // Each level is filtered from the one before it, two buffers are swapped back and forth
+    uint8_t *level_px = malloc( 4 * ATLAS_WIDTH * ATLAS_HEIGHT );
+    uint8_t *next_px = malloc( 4 * ATLAS_WIDTH * ATLAS_HEIGHT / 4 );
+    memcpy( level_px, s_atlas, 4 * ATLAS_WIDTH * ATLAS_HEIGHT );
+
+    uint8_t *level_out = out;
+    for( uint32_t level = 0; level < mipLevels; ++level )
+    {
+        uint32_t w = mip_dimension( ATLAS_WIDTH, level ), h = mip_dimension( ATLAS_HEIGHT, level );
+
+        encode_level( format, level_px, w, h, level_out );
+        level_out += level_size( format, w, h );
+
+        if( level + 1 < mipLevels )
+        {
+            uint32_t nw = mip_dimension( ATLAS_WIDTH, level + 1 ), nh = mip_dimension( ATLAS_HEIGHT, level + 1 );
+            downsample( level_px, w, h, next_px, nw, nh );
+
+            uint8_t *t = level_px;
+            level_px = next_px;
+            next_px = t;
+        }
+    }
+
+    free( level_px );
+    free( next_px );
+    return size;
+}
\ No newline at end of file
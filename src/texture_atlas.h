@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libsm64.h"
+
+extern void texture_atlas_store( const uint8_t *texture, uint32_t flags );
+extern size_t texture_atlas_export( enum SM64TextureFormat format, uint32_t mipLevels, uint8_t *out );
+extern void texture_atlas_free( void );
\ No newline at end of file